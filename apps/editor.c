@@ -2,7 +2,7 @@
 #include "vga.h"
 #include "keyboard.h"
 #include "string.h"
-#include "fs.h"
+#include "vfs.h"
 
 static struct editor_state editor;
 
@@ -13,13 +13,14 @@ static struct editor_state editor;
 
 static void editor_init(const char *filename) {
     mem_set(&editor, 0, sizeof(struct editor_state));
-    str_ncpy(editor.filename, filename, 31);
+    str_ncpy(editor.filename, filename, sizeof(editor.filename) - 1);
     editor.line_count = 1;
     editor.cursor_row = 0;
     editor.cursor_col = 0;
     editor.view_top = 0;
     editor.modified = FALSE;
     editor.running = TRUE;
+    editor.load_failed = FALSE;
 
     // Initialize first line as empty
     editor.lines[0][0] = '\0';
@@ -27,25 +28,35 @@ static void editor_init(const char *filename) {
 }
 
 static void editor_load_file(void) {
-    uint32_t inode_num;
-
-    if (!fs_open(editor.filename, &inode_num)) {
+    struct vnode *vn = vfs_open(editor.filename);
+    if (vn == NULL) {
         editor.is_new_file = TRUE;
         str_cpy(editor.status_msg, "New file");
         return;
     }
 
     editor.is_new_file = FALSE;
-    editor.file_inode = inode_num;
 
     // Read file content
     static uint8_t file_buf[EDITOR_MAX_LINES * EDITOR_MAX_COLS];
-    uint32_t size = 0;
 
-    if (!fs_read(inode_num, file_buf, &size)) {
+    // The whole file is read at once, so it must fit the buffer
+    struct vnode_attr attr;
+    if (!vfs_getattr(vn, &attr) || attr.size > sizeof(file_buf)) {
+        vfs_close(vn);
+        str_cpy(editor.status_msg, "File too large to edit");
+        editor.load_failed = TRUE;
+        editor.running = FALSE;
+        return;
+    }
+
+    int32_t got = vfs_read(vn, file_buf, attr.size, 0);
+    vfs_close(vn);
+    if (got != (int32_t)attr.size) {
         str_cpy(editor.status_msg, "Error reading file");
         return;
     }
+    uint32_t size = attr.size;
 
     // Parse into lines
     editor.line_count = 0;
@@ -83,17 +94,19 @@ static void editor_load_file(void) {
 static void editor_save_file(void) {
     // Create file if new
     if (editor.is_new_file) {
-        if (!fs_create(editor.filename)) {
+        if (!vfs_create(editor.filename)) {
             str_cpy(editor.status_msg, "Error creating file");
             return;
         }
-        if (!fs_open(editor.filename, &editor.file_inode)) {
-            str_cpy(editor.status_msg, "Error opening file");
-            return;
-        }
         editor.is_new_file = FALSE;
     }
 
+    struct vnode *vn = vfs_open(editor.filename);
+    if (vn == NULL) {
+        str_cpy(editor.status_msg, "Error opening file");
+        return;
+    }
+
     // Build file content
     static uint8_t file_buf[EDITOR_MAX_LINES * EDITOR_MAX_COLS];
     uint32_t pos = 0;
@@ -105,8 +118,14 @@ static void editor_save_file(void) {
         file_buf[pos++] = '\n';
     }
 
-    // Write to disk
-    if (fs_write(editor.file_inode, file_buf, pos)) {
+    // Overwrite the contents, then cut off whatever is left of a longer old
+    // version. A failed write leaves the old data behind rather than none.
+    struct vnode_attr attr;
+    bool ok = vfs_getattr(vn, &attr) && vfs_write(vn, file_buf, pos, 0) == (int32_t)pos &&
+              (attr.size <= pos || vfs_truncate(vn, pos)) && vfs_fsync(vn);
+    vfs_close(vn);
+
+    if (ok) {
         editor.modified = FALSE;
         str_cpy(editor.status_msg, "File saved");
     } else {
@@ -454,4 +473,10 @@ void editor_run(const char *filename) {
 
     keyboard_set_echo(TRUE);
     vga_clear();
+
+    // A file that could not be opened leaves its reason behind
+    if (editor.load_failed) {
+        vga_puts(editor.status_msg);
+        vga_putchar('\n');
+    }
 }
@@ -1,39 +1,614 @@
 #include "ata.h"
 #include "io.h"
 #include "vga.h"
+#include "pci.h"
+#include "pic.h"
+#include "timer.h"
+
+// What the command in flight on a channel is doing
+#define MODE_IDLE       0
+#define MODE_DMA        1
+#define MODE_PIO_READ   2
+#define MODE_PIO_WRITE  3
+#define MODE_FLUSH      4
+
+// Part of a request carried by the command in flight
+struct ata_segment {
+    struct ata_request *req;
+    uint32_t offset;            // First sector within the request
+    uint32_t count;
+};
+
+// Per-channel state: registers, request queue and the command in flight
+struct ata_channel {
+    bool     present;           // Something answers on the task-file registers
+    uint16_t io_base;
+    uint16_t ctrl_base;
+    uint16_t bm_base;           // 0 = no bus master for this channel
+    struct ata_prd *prdt;
+
+    struct ata_request *queue;  // Pending and active requests, oldest first
+    uint64_t head_key;          // Elevator position (end of the last command)
+    uint8_t  plugged;           // ata_plug depth: no new command starts while nonzero
+
+    uint8_t  mode;              // MODE_*
+    struct ata_segment segs[ATA_MAX_SEGMENTS];
+    uint8_t  seg_count;
+    uint8_t  seg_index;         // PIO progress: current segment
+    uint32_t seg_sector;        // PIO progress: sector within segment
+    uint32_t started;           // Tick of the last progress on the command
+};
+
+static struct ata_drive drives[ATA_MAX_DRIVES];
+static struct ata_channel channels[ATA_CHANNELS];
+
+// PRD tables: aligning to their own size keeps them from crossing a 64 KiB boundary
+static struct ata_prd prd_tables[ATA_CHANNELS][ATA_PRD_ENTRIES] __attribute__((aligned(256)));
+
+static void ata_dispatch(struct ata_channel *ch);
+
+// Disable interrupts, returning the previous EFLAGS
+static uint32_t irq_save(void) {
+    uint32_t flags;
+    __asm__ volatile("pushfl; popl %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
 
-static struct ata_drive drives[2];  // Master and slave
+static void irq_restore(uint32_t flags) {
+    if (flags & 0x200) {
+        __asm__ volatile("sti" ::: "memory");
+    }
+}
 
-// Wait for drive to be ready (not busy)
-static void ata_wait_bsy(void) {
-    while (inb(ATA_PRIMARY_STATUS) & ATA_STATUS_BSY);
+static struct ata_channel* ata_channel_of(uint8_t drive) {
+    return &channels[drive >> 1];
 }
 
-// Wait for drive to be ready and have data
-static void ata_wait_drq(void) {
-    while (!(inb(ATA_PRIMARY_STATUS) & ATA_STATUS_DRQ));
+// Ticks since 'start' have exceeded the command timeout
+static bool ata_timed_out(uint32_t start) {
+    return timer_get_ticks() - start > TIMER_MS_TO_TICKS(ATA_TIMEOUT_MS);
+}
+
+// Wait for drive to be ready (not busy), FALSE on timeout.
+// Bounded in iterations too, since ticks stand still inside an IRQ.
+static bool ata_wait_bsy(struct ata_channel *ch) {
+    uint32_t start = timer_get_ticks();
+    for (uint32_t spins = 0; spins < ATA_SPIN_LIMIT; spins++) {
+        if (!(inb(ch->ctrl_base) & ATA_STATUS_BSY)) return TRUE;
+        if (ata_timed_out(start)) return FALSE;
+    }
+    return FALSE;
+}
+
+// Wait for drive to be ready and have data, FALSE on error or timeout
+static bool ata_wait_drq(struct ata_channel *ch) {
+    uint32_t start = timer_get_ticks();
+    for (uint32_t spins = 0; spins < ATA_SPIN_LIMIT; spins++) {
+        uint8_t status = inb(ch->ctrl_base);
+        if (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) return FALSE;
+        if (!(status & ATA_STATUS_BSY) && (status & ATA_STATUS_DRQ)) return TRUE;
+        if (ata_timed_out(start)) return FALSE;
+    }
+    return FALSE;
 }
 
 // 400ns delay (read alternate status 4 times)
-static void ata_delay(void) {
-    inb(ATA_PRIMARY_ALTSTATUS);
-    inb(ATA_PRIMARY_ALTSTATUS);
-    inb(ATA_PRIMARY_ALTSTATUS);
-    inb(ATA_PRIMARY_ALTSTATUS);
+static void ata_delay(struct ata_channel *ch) {
+    inb(ch->ctrl_base);
+    inb(ch->ctrl_base);
+    inb(ch->ctrl_base);
+    inb(ch->ctrl_base);
 }
 
-// Select a drive (0 = master, 1 = slave)
+// Select a drive on its channel
 static void ata_select_drive(uint8_t drive) {
-    outb(ATA_PRIMARY_DRIVE, drive == 0 ? ATA_DRIVE_MASTER : ATA_DRIVE_SLAVE);
-    ata_delay();  // Wait for drive selection
+    struct ata_channel *ch = ata_channel_of(drive);
+    outb(ch->io_base + ATA_REG_DRIVE, (drive & 1) == 0 ? ATA_DRIVE_MASTER : ATA_DRIVE_SLAVE);
+    ata_delay(ch);  // Wait for drive selection
+}
+
+void ata_soft_reset(uint8_t channel) {
+    struct ata_channel *ch = &channels[channel];
+    outb(ch->ctrl_base, 0x04);  // Set SRST bit
+    ata_delay(ch);
+    outb(ch->ctrl_base, 0x00);  // Clear SRST bit
+    ata_delay(ch);
+    ata_wait_bsy(ch);
+}
+
+// Program drive, LBA and sector count for the next command.
+// A count of 256 (LBA28) or 65536 (LBA48) is encoded as 0 by the masking.
+static void ata_setup_lba(uint8_t drive, uint64_t lba, uint32_t count, bool ext) {
+    struct ata_channel *ch = ata_channel_of(drive);
+    uint16_t io = ch->io_base;
+    bool slave = drive & 1;
+
+    if (ext) {
+        // LBA48: the high-order bytes go in first, then the low-order bytes
+        outb(io + ATA_REG_DRIVE, slave ? ATA_DRIVE_LBA48_SLAVE : ATA_DRIVE_LBA48_MASTER);
+        ata_delay(ch);
+
+        outb(io + ATA_REG_SECCOUNT, (count >> 8) & 0xFF);
+        outb(io + ATA_REG_LBA_LO, (lba >> 24) & 0xFF);
+        outb(io + ATA_REG_LBA_MID, (lba >> 32) & 0xFF);
+        outb(io + ATA_REG_LBA_HI, (lba >> 40) & 0xFF);
+    } else {
+        // Select drive and set high LBA bits
+        outb(io + ATA_REG_DRIVE, (slave ? 0xF0 : 0xE0) | ((lba >> 24) & 0x0F));
+        ata_delay(ch);
+    }
+
+    // Set sector count and LBA
+    outb(io + ATA_REG_SECCOUNT, count & 0xFF);
+    outb(io + ATA_REG_LBA_LO, lba & 0xFF);
+    outb(io + ATA_REG_LBA_MID, (lba >> 8) & 0xFF);
+    outb(io + ATA_REG_LBA_HI, (lba >> 16) & 0xFF);
+}
+
+// Look for a PCI bus-master IDE controller (PIIX-style BMIDE)
+static void ata_dma_init(void) {
+    struct pci_device ide;
+
+    if (!pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &ide)) {
+        return;
+    }
+
+    // Programming interface bit 7: bus mastering supported
+    if (!(ide.prog_if & 0x80)) {
+        return;
+    }
+
+    // BAR4 holds the bus-master register block (must be I/O space)
+    uint32_t bar4 = pci_read32(&ide, PCI_BAR4);
+    if (!(bar4 & 0x01) || (bar4 & 0xFFFC) == 0) {
+        return;
+    }
+
+    uint16_t cmd = pci_read16(&ide, PCI_COMMAND);
+    pci_write16(&ide, PCI_COMMAND, cmd | PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+
+    channels[0].bm_base = bar4 & 0xFFFC;
+    channels[1].bm_base = (bar4 & 0xFFFC) + ATA_BM_SECONDARY;
+}
+
+// PRD entries needed to describe a buffer (regions may not cross 64 KiB)
+static uint32_t ata_prd_count(const void *buffer, uint32_t bytes) {
+    uint32_t addr = (uint32_t)buffer;
+    return ((addr + bytes - 1) >> 16) - (addr >> 16) + 1;
+}
+
+// Append a buffer to the channel's PRD table, returns the new entry count
+static uint32_t ata_prd_append(struct ata_channel *ch, uint32_t n, const void *buffer, uint32_t bytes) {
+    uint32_t addr = (uint32_t)buffer;   // Identity mapped: virtual == physical
+
+    while (bytes > 0) {
+        uint32_t chunk = 0x10000 - (addr & 0xFFFF);
+        if (chunk > bytes) chunk = bytes;
+
+        ch->prdt[n].phys_addr = addr;
+        ch->prdt[n].byte_count = chunk & 0xFFFF;   // 64 KiB encodes as 0
+        ch->prdt[n].flags = 0;
+
+        addr += chunk;
+        bytes -= chunk;
+        n++;
+    }
+    return n;
+}
+
+// Can this request's buffer go through the bus-master engine?
+static bool ata_dma_usable(const struct ata_request *req) {
+    struct ata_channel *ch = ata_channel_of(req->drive);
+    return ch->bm_base != 0 && drives[req->drive].dma && ((uint32_t)req->buffer & 1) == 0;
+}
+
+// Elevator key: master before slave, then LBA of the next untransferred sector
+static uint64_t ata_key(const struct ata_request *req) {
+    return ((uint64_t)(req->drive & 1) << 48) | (req->lba + req->done);
+}
+
+static bool ata_overlaps(const struct ata_request *a, const struct ata_request *b) {
+    if (a->drive != b->drive) return FALSE;
+    return a->lba + a->done < b->lba + b->count && b->lba + b->done < a->lba + a->count;
+}
+
+// A request may start only if no older request must go first: flushes are
+// barriers, and overlapping I/O keeps submission order when either side writes.
+static bool ata_dispatchable(struct ata_channel *ch, const struct ata_request *req) {
+    for (struct ata_request *o = ch->queue; o != req; o = o->next) {
+        if (o->type == ATA_REQ_FLUSH || req->type == ATA_REQ_FLUSH) return FALSE;
+        if ((o->type == ATA_REQ_WRITE || req->type == ATA_REQ_WRITE) && ata_overlaps(o, req)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// C-LOOK: the lowest key at or after the head, else wrap to the lowest key
+static struct ata_request* ata_pick(struct ata_channel *ch) {
+    struct ata_request *ahead = NULL;
+    struct ata_request *lowest = NULL;
+
+    for (struct ata_request *r = ch->queue; r; r = r->next) {
+        if (r->status != ATA_REQ_PENDING || !ata_dispatchable(ch, r)) continue;
+        if (r->type == ATA_REQ_FLUSH) return r;
+
+        uint64_t key = ata_key(r);
+        if (key >= ch->head_key && (!ahead || key < ata_key(ahead))) ahead = r;
+        if (!lowest || key < ata_key(lowest)) lowest = r;
+    }
+
+    return ahead ? ahead : lowest;
+}
+
+static void ata_add_segment(struct ata_channel *ch, struct ata_request *req, uint32_t count) {
+    struct ata_segment *seg = &ch->segs[ch->seg_count++];
+    seg->req = req;
+    seg->offset = req->done;
+    seg->count = count;
+    req->status = ATA_REQ_ACTIVE;
+}
+
+// Build the next command around 'first', merging queued requests that
+// continue it on disk. Returns the number of sectors in the command.
+static uint32_t ata_build_batch(struct ata_channel *ch, struct ata_request *first, bool dma) {
+    uint32_t max = drives[first->drive].lba48 ? ATA_MAX_SECTORS_LBA48 : ATA_MAX_SECTORS_LBA28;
+    if (dma && max > ATA_DMA_MAX_SECTORS) max = ATA_DMA_MAX_SECTORS;
+
+    ch->seg_count = 0;
+
+    uint32_t total = first->count - first->done;
+    if (total > max) total = max;
+    ata_add_segment(ch, first, total);
+
+    uint32_t prds = dma ? ata_prd_count((uint8_t *)first->buffer + first->done * ATA_SECTOR_SIZE,
+                                        total * ATA_SECTOR_SIZE) : 0;
+    uint64_t end = first->lba + first->done + total;
+
+    while (total < max && ch->seg_count < ATA_MAX_SEGMENTS) {
+        struct ata_request *next = NULL;
+
+        for (struct ata_request *r = ch->queue; r; r = r->next) {
+            if (r->status == ATA_REQ_PENDING && r->drive == first->drive &&
+                r->type == first->type && r->lba + r->done == end &&
+                (!dma || ata_dma_usable(r)) && ata_dispatchable(ch, r)) {
+                next = r;
+                break;
+            }
+        }
+        if (!next) break;
+
+        uint32_t n = next->count - next->done;
+        if (n > max - total) n = max - total;
+
+        if (dma) {
+            uint32_t need = ata_prd_count((uint8_t *)next->buffer + next->done * ATA_SECTOR_SIZE,
+                                          n * ATA_SECTOR_SIZE);
+            if (prds + need > ATA_PRD_ENTRIES) break;
+            prds += need;
+        }
+
+        ata_add_segment(ch, next, n);
+        total += n;
+        end += n;
+    }
+
+    return total;
+}
+
+// Buffer address of the current PIO sector
+static uint16_t* ata_pio_ptr(struct ata_channel *ch) {
+    struct ata_segment *seg = &ch->segs[ch->seg_index];
+    return (uint16_t *)((uint8_t *)seg->req->buffer + (seg->offset + ch->seg_sector) * ATA_SECTOR_SIZE);
+}
+
+// Advance PIO progress by one sector, TRUE when the command is complete
+static bool ata_pio_advance(struct ata_channel *ch) {
+    ch->started = timer_get_ticks();
+    if (++ch->seg_sector == ch->segs[ch->seg_index].count) {
+        ch->seg_sector = 0;
+        ch->seg_index++;
+    }
+    return ch->seg_index == ch->seg_count;
+}
+
+// Complete the command in flight and start the next one
+static void ata_finish(struct ata_channel *ch, bool ok) {
+    struct ata_segment *last = &ch->segs[ch->seg_count - 1];
+
+    ch->mode = MODE_IDLE;
+    if (last->req->type != ATA_REQ_FLUSH) {
+        ch->head_key = ((uint64_t)(last->req->drive & 1) << 48) |
+                       (last->req->lba + last->offset + last->count);
+    }
+
+    for (uint8_t i = 0; i < ch->seg_count; i++) {
+        struct ata_request *req = ch->segs[i].req;
+
+        if (ok) req->done += ch->segs[i].count;
+
+        if (ok && req->done < req->count) {
+            req->status = ATA_REQ_PENDING;     // More commands to go
+            continue;
+        }
+
+        // Unlink from the queue
+        struct ata_request **link = &ch->queue;
+        while (*link != req) link = &(*link)->next;
+        *link = req->next;
+
+        req->status = ok ? ATA_REQ_DONE : ATA_REQ_ERROR;
+        if (req->callback) req->callback(req);
+    }
+
+    ata_dispatch(ch);
+}
+
+// Issue the command described by the channel's segments
+static void ata_start(struct ata_channel *ch, uint32_t total, bool dma) {
+    struct ata_request *first = ch->segs[0].req;
+    uint8_t drive = first->drive;
+    uint16_t io = ch->io_base;
+
+    ch->started = timer_get_ticks();
+
+    if (!ata_wait_bsy(ch)) {
+        ata_finish(ch, FALSE);
+        return;
+    }
+
+    if (first->type == ATA_REQ_FLUSH) {
+        ata_select_drive(drive);
+        ch->mode = MODE_FLUSH;
+        outb(io + ATA_REG_COMMAND, drives[drive].lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+        return;
+    }
+
+    // Use EXT commands above the 28-bit limit or for batches LBA28 cannot carry
+    uint64_t lba = first->lba + first->done;
+    bool ext = lba + total > ATA_LBA28_LIMIT || total > ATA_MAX_SECTORS_LBA28;
+    if (ext && !drives[drive].lba48) {
+        ata_finish(ch, FALSE);
+        return;
+    }
+
+    bool write = first->type == ATA_REQ_WRITE;
+
+    if (dma) {
+        uint16_t bm = ch->bm_base;
+        uint8_t direction = write ? 0 : ATA_BM_CMD_READ;
+
+        uint32_t n = 0;
+        for (uint8_t i = 0; i < ch->seg_count; i++) {
+            struct ata_segment *seg = &ch->segs[i];
+            n = ata_prd_append(ch, n, (uint8_t *)seg->req->buffer + seg->offset * ATA_SECTOR_SIZE,
+                               seg->count * ATA_SECTOR_SIZE);
+        }
+        ch->prdt[n - 1].flags = ATA_PRD_EOT;
+
+        // Stop engine, load PRD table, set direction, clear stale status
+        outb(bm + ATA_BM_COMMAND, 0);
+        outl(bm + ATA_BM_PRDT, (uint32_t)ch->prdt);
+        outb(bm + ATA_BM_COMMAND, direction);
+        outb(bm + ATA_BM_STATUS, inb(bm + ATA_BM_STATUS) | ATA_BM_STATUS_IRQ | ATA_BM_STATUS_ERR);
+
+        ata_setup_lba(drive, lba, total, ext);
+
+        ch->mode = MODE_DMA;
+        if (write) {
+            outb(io + ATA_REG_COMMAND, ext ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA);
+        } else {
+            outb(io + ATA_REG_COMMAND, ext ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA);
+        }
+        outb(bm + ATA_BM_COMMAND, direction | ATA_BM_CMD_START);
+        return;
+    }
+
+    // PIO: the IRQ handler moves one sector per interrupt
+    ch->seg_index = 0;
+    ch->seg_sector = 0;
+    ata_setup_lba(drive, lba, total, ext);
+
+    if (!write) {
+        ch->mode = MODE_PIO_READ;
+        outb(io + ATA_REG_COMMAND, ext ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO);
+        return;
+    }
+
+    ch->mode = MODE_PIO_WRITE;
+    outb(io + ATA_REG_COMMAND, ext ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO);
+
+    // The first sector is sent without waiting for an interrupt
+    if (!ata_wait_drq(ch)) {
+        ata_finish(ch, FALSE);
+        return;
+    }
+    outsw(io + ATA_REG_DATA, ata_pio_ptr(ch), 256);
+    ata_pio_advance(ch);
+}
+
+// Start the next command if the channel is idle
+static void ata_dispatch(struct ata_channel *ch) {
+    if (ch->mode != MODE_IDLE || ch->plugged) return;
+
+    struct ata_request *req = ata_pick(ch);
+    if (!req) return;
+
+    if (req->type == ATA_REQ_FLUSH) {
+        ch->seg_count = 0;
+        ata_add_segment(ch, req, 0);
+        ata_start(ch, 0, FALSE);
+        return;
+    }
+
+    bool dma = ata_dma_usable(req);
+    uint32_t total = ata_build_batch(ch, req, dma);
+    ata_start(ch, total, dma);
+}
+
+// Advance the command in flight given the latched drive and bus-master status
+static void ata_service(struct ata_channel *ch, uint8_t status, uint8_t bm_status) {
+    bool failed = (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) != 0;
+
+    switch (ch->mode) {
+        case MODE_DMA:
+            if ((status & ATA_STATUS_BSY) && !(bm_status & ATA_BM_STATUS_IRQ)) return;
+            outb(ch->bm_base + ATA_BM_COMMAND, 0);
+            ata_finish(ch, !failed && !(bm_status & ATA_BM_STATUS_ERR));
+            break;
+
+        case MODE_FLUSH:
+            if (status & ATA_STATUS_BSY) return;
+            ata_finish(ch, !failed);
+            break;
+
+        case MODE_PIO_READ:
+            // Interrupt means the next sector is ready
+            if (status & ATA_STATUS_BSY) return;
+            if (failed || !(status & ATA_STATUS_DRQ)) {
+                ata_finish(ch, FALSE);
+                return;
+            }
+            insw(ch->io_base + ATA_REG_DATA, ata_pio_ptr(ch), 256);
+            if (ata_pio_advance(ch)) ata_finish(ch, TRUE);
+            break;
+
+        case MODE_PIO_WRITE:
+            // Interrupt means the last sector was accepted
+            if (status & ATA_STATUS_BSY) return;
+            if (failed) {
+                ata_finish(ch, FALSE);
+                return;
+            }
+            if (ch->seg_index == ch->seg_count) {
+                ata_finish(ch, TRUE);
+                return;
+            }
+            if (!(status & ATA_STATUS_DRQ)) {
+                ata_finish(ch, FALSE);
+                return;
+            }
+            outsw(ch->io_base + ATA_REG_DATA, ata_pio_ptr(ch), 256);
+            ata_pio_advance(ch);
+            break;
+    }
+}
+
+void ata_irq_handler(uint8_t channel) {
+    struct ata_channel *ch = &channels[channel];
+    uint8_t bm_status = 0;
+
+    if (ch->bm_base) {
+        // Latch and clear the bus-master interrupt/error bits
+        bm_status = inb(ch->bm_base + ATA_BM_STATUS);
+        outb(ch->bm_base + ATA_BM_STATUS, bm_status);
+    }
+
+    // Reading the status register acknowledges the interrupt at the drive
+    uint8_t status = inb(ch->io_base + ATA_REG_STATUS);
+    ata_service(ch, status, bm_status);
+}
+
+// The command in flight made no progress within the timeout
+static void ata_recover(struct ata_channel *ch, uint8_t channel) {
+    if (!(inb(ch->ctrl_base) & ATA_STATUS_BSY)) {
+        // Lost interrupt: service the command as if it had fired
+        ata_irq_handler(channel);
+        return;
+    }
+
+    // Drive is hung: stop DMA, reset the channel and fail the command
+    if (ch->bm_base) outb(ch->bm_base + ATA_BM_COMMAND, 0);
+    ata_soft_reset(channel);
+    ata_finish(ch, FALSE);
+}
+
+bool ata_submit(struct ata_request *req) {
+    if (req->drive >= ATA_MAX_DRIVES || !drives[req->drive].present) return FALSE;
+
+    if (req->type == ATA_REQ_FLUSH) {
+        req->count = 0;
+    } else if (req->count == 0 || req->buffer == NULL) {
+        return FALSE;
+    }
+
+    struct ata_channel *ch = ata_channel_of(req->drive);
+    uint32_t flags = irq_save();
+
+    req->status = ATA_REQ_PENDING;
+    req->done = 0;
+    req->next = NULL;
+
+    // Append: the queue stays in submission order
+    struct ata_request **link = &ch->queue;
+    while (*link) link = &(*link)->next;
+    *link = req;
+
+    ata_dispatch(ch);
+    irq_restore(flags);
+    return TRUE;
+}
+
+// Hold back new commands on a drive's channel while a batch of requests is
+// queued, so the batch is merged as a whole instead of its first request
+// going out alone. Waiting for a request that is still held lets the
+// channel go early rather than wait forever.
+void ata_plug(uint8_t drive) {
+    uint32_t flags = irq_save();
+    ata_channel_of(drive)->plugged++;
+    irq_restore(flags);
+}
+
+void ata_unplug(uint8_t drive) {
+    struct ata_channel *ch = ata_channel_of(drive);
+    uint32_t flags = irq_save();
+    if (ch->plugged > 0 && --ch->plugged == 0) ata_dispatch(ch);
+    irq_restore(flags);
+}
+
+// Sleep until the request completes. The timer tick wakes us up to check
+// for a stalled command; keyboard IRQs keep being serviced while we wait.
+bool ata_wait(struct ata_request *req) {
+    uint8_t channel = req->drive >> 1;
+    struct ata_channel *ch = &channels[channel];
+
+    // The request may be held behind a plug: let the channel go
+    uint32_t flags = irq_save();
+    if (ch->plugged > 0 && req->status == ATA_REQ_PENDING) {
+        ch->plugged = 0;
+        ata_dispatch(ch);
+    }
+    irq_restore(flags);
+
+    while (1) {
+        // sti only takes effect after hlt starts, so no interrupt is lost
+        __asm__ volatile("cli" ::: "memory");
+        if (req->status == ATA_REQ_DONE || req->status == ATA_REQ_ERROR) break;
+
+        if (ch->mode != MODE_IDLE && ata_timed_out(ch->started)) {
+            ata_recover(ch, channel);
+            continue;
+        }
+        __asm__ volatile("sti; hlt" ::: "memory");
+    }
+    __asm__ volatile("sti" ::: "memory");
+
+    return req->status == ATA_REQ_DONE;
 }
 
-void ata_soft_reset(void) {
-    outb(ATA_PRIMARY_CONTROL, 0x04);  // Set SRST bit
-    ata_delay();
-    outb(ATA_PRIMARY_CONTROL, 0x00);  // Clear SRST bit
-    ata_delay();
-    ata_wait_bsy();
+// Synchronous helper: submit one request and wait for it
+static bool ata_do(uint8_t type, uint8_t drive, uint64_t lba, uint32_t count, void *buffer) {
+    struct ata_request req;
+    req.type = type;
+    req.drive = drive;
+    req.lba = lba;
+    req.count = count;
+    req.buffer = buffer;
+    req.callback = NULL;
+    req.context = NULL;
+
+    if (!ata_submit(&req)) return FALSE;
+    return ata_wait(&req);
 }
 
 static void fix_ata_string(char *str, int len) {
@@ -50,61 +625,79 @@ static void fix_ata_string(char *str, int len) {
 }
 
 bool ata_identify(uint8_t drive, struct ata_drive *info) {
+    struct ata_channel *ch = ata_channel_of(drive);
+    uint16_t io = ch->io_base;
     uint16_t buffer[256];
 
     info->present = FALSE;
     info->drive_num = drive;
 
+    if (!ch->present) {
+        return FALSE;
+    }
+
     // Select drive
     ata_select_drive(drive);
 
     // Set sector count and LBA to 0
-    outb(ATA_PRIMARY_SECCOUNT, 0);
-    outb(ATA_PRIMARY_LBA_LO, 0);
-    outb(ATA_PRIMARY_LBA_MID, 0);
-    outb(ATA_PRIMARY_LBA_HI, 0);
+    outb(io + ATA_REG_SECCOUNT, 0);
+    outb(io + ATA_REG_LBA_LO, 0);
+    outb(io + ATA_REG_LBA_MID, 0);
+    outb(io + ATA_REG_LBA_HI, 0);
 
     // Send IDENTIFY command
-    outb(ATA_PRIMARY_COMMAND, ATA_CMD_IDENTIFY);
-    ata_delay();
+    outb(io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay(ch);
 
-    // Check if drive exists
-    uint8_t status = inb(ATA_PRIMARY_STATUS);
-    if (status == 0) {
+    // Check if drive exists (0xFF = floating bus, no controller)
+    uint8_t status = inb(io + ATA_REG_STATUS);
+    if (status == 0 || status == 0xFF) {
         return FALSE;  // No drive
     }
 
     // Wait for BSY to clear
-    ata_wait_bsy();
+    if (!ata_wait_bsy(ch)) {
+        return FALSE;
+    }
 
     // Check for ATAPI
-    uint8_t lba_mid = inb(ATA_PRIMARY_LBA_MID);
-    uint8_t lba_hi = inb(ATA_PRIMARY_LBA_HI);
+    uint8_t lba_mid = inb(io + ATA_REG_LBA_MID);
+    uint8_t lba_hi = inb(io + ATA_REG_LBA_HI);
     if (lba_mid != 0 || lba_hi != 0) {
         info->is_atapi = TRUE;
         return FALSE;  // Skip ATAPI for now
     }
 
     // Wait for DRQ or ERR
-    while (1) {
-        status = inb(ATA_PRIMARY_STATUS);
-        if (status & ATA_STATUS_ERR) {
-            return FALSE;  // Error
-        }
-        if (status & ATA_STATUS_DRQ) {
-            break;  // Ready to transfer
-        }
+    if (!ata_wait_drq(ch)) {
+        return FALSE;
     }
 
     // Read identification data (256 words = 512 bytes)
-    insw(ATA_PRIMARY_DATA, buffer, 256);
+    insw(io + ATA_REG_DATA, buffer, 256);
 
     // Parse the identification data
     info->present = TRUE;
     info->is_atapi = FALSE;
 
-    // Get total sectors (words 60-61)
-    info->size_sectors = buffer[60] | ((uint32_t)buffer[61] << 16);
+    // Multiword/UDMA supported (word 49, bit 8)
+    info->dma = (buffer[49] & 0x0100) != 0;
+
+    // LBA48 feature set supported (word 83, bit 10)
+    info->lba48 = (buffer[83] & 0x0400) != 0;
+
+    // Get total sectors (words 100-103). Some drives set the LBA48 bit but
+    // leave these zero, so fall back to the 28-bit count (words 60-61).
+    info->size_sectors = 0;
+    if (info->lba48) {
+        info->size_sectors = buffer[100] |
+                             ((uint64_t)buffer[101] << 16) |
+                             ((uint64_t)buffer[102] << 32) |
+                             ((uint64_t)buffer[103] << 48);
+    }
+    if (info->size_sectors == 0) {
+        info->size_sectors = buffer[60] | ((uint32_t)buffer[61] << 16);
+    }
 
     // Get model string (words 27-46)
     for (int i = 0; i < 40; i++) {
@@ -116,106 +709,78 @@ bool ata_identify(uint8_t drive, struct ata_drive *info) {
     return TRUE;
 }
 
-bool ata_read_sectors(uint8_t drive, uint32_t lba, uint8_t count, void *buffer) {
+bool ata_read_sectors(uint8_t drive, uint64_t lba, uint32_t count, void *buffer) {
     if (count == 0) return FALSE;
-
-    ata_wait_bsy();
-
-    // Select drive and set high LBA bits
-    outb(ATA_PRIMARY_DRIVE, (drive == 0 ? 0xE0 : 0xF0) | ((lba >> 24) & 0x0F));
-    ata_delay();
-
-    // Set sector count and LBA
-    outb(ATA_PRIMARY_SECCOUNT, count);
-    outb(ATA_PRIMARY_LBA_LO, lba & 0xFF);
-    outb(ATA_PRIMARY_LBA_MID, (lba >> 8) & 0xFF);
-    outb(ATA_PRIMARY_LBA_HI, (lba >> 16) & 0xFF);
-
-    // Send read command
-    outb(ATA_PRIMARY_COMMAND, ATA_CMD_READ_PIO);
-
-    uint16_t *buf = (uint16_t *)buffer;
-
-    for (int s = 0; s < count; s++) {
-        // Wait for data
-        ata_wait_bsy();
-
-        uint8_t status = inb(ATA_PRIMARY_STATUS);
-        if (status & ATA_STATUS_ERR) {
-            return FALSE;
-        }
-
-        ata_wait_drq();
-
-        // Read 256 words (512 bytes)
-        insw(ATA_PRIMARY_DATA, buf, 256);
-        buf += 256;
-    }
-
-    return TRUE;
+    return ata_do(ATA_REQ_READ, drive, lba, count, buffer);
 }
 
-bool ata_write_sectors(uint8_t drive, uint32_t lba, uint8_t count, const void *buffer) {
+bool ata_write_sectors(uint8_t drive, uint64_t lba, uint32_t count, const void *buffer) {
     if (count == 0) return FALSE;
+    return ata_do(ATA_REQ_WRITE, drive, lba, count, (void *)buffer);
+}
 
-    ata_wait_bsy();
-
-    // Select drive and set high LBA bits
-    outb(ATA_PRIMARY_DRIVE, (drive == 0 ? 0xE0 : 0xF0) | ((lba >> 24) & 0x0F));
-    ata_delay();
-
-    // Set sector count and LBA
-    outb(ATA_PRIMARY_SECCOUNT, count);
-    outb(ATA_PRIMARY_LBA_LO, lba & 0xFF);
-    outb(ATA_PRIMARY_LBA_MID, (lba >> 8) & 0xFF);
-    outb(ATA_PRIMARY_LBA_HI, (lba >> 16) & 0xFF);
-
-    // Send write command
-    outb(ATA_PRIMARY_COMMAND, ATA_CMD_WRITE_PIO);
-
-    const uint16_t *buf = (const uint16_t *)buffer;
-
-    for (int s = 0; s < count; s++) {
-        ata_wait_bsy();
-        ata_wait_drq();
-
-        // Write 256 words (512 bytes)
-        outsw(ATA_PRIMARY_DATA, buf, 256);
-        buf += 256;
-    }
-
-    // Flush cache
-    outb(ATA_PRIMARY_COMMAND, ATA_CMD_CACHE_FLUSH);
-    ata_wait_bsy();
-
-    return TRUE;
+bool ata_flush(uint8_t drive) {
+    // Flush the drive's write cache to media (after every older request)
+    return ata_do(ATA_REQ_FLUSH, drive, 0, 0, NULL);
 }
 
 struct ata_drive* ata_get_drive(uint8_t drive) {
-    if (drive > 1) return NULL;
+    if (drive >= ATA_MAX_DRIVES) return NULL;
     return &drives[drive];
 }
 
 void ata_init(void) {
+    static const char *names[ATA_MAX_DRIVES] = {
+        "Primary master", "Primary slave", "Secondary master", "Secondary slave"
+    };
+
     vga_puts("ATA: Initializing...\n");
 
-    // Soft reset
-    ata_soft_reset();
+    channels[0].io_base = ATA_PRIMARY_DATA;
+    channels[0].ctrl_base = ATA_PRIMARY_CONTROL;
+    channels[1].io_base = ATA_SECONDARY_IO;
+    channels[1].ctrl_base = ATA_SECONDARY_CONTROL;
+
+    for (uint8_t c = 0; c < ATA_CHANNELS; c++) {
+        channels[c].prdt = prd_tables[c];
+        channels[c].mode = MODE_IDLE;
+
+        // A floating bus reads 0xFF: no controller behind these ports
+        channels[c].present = inb(channels[c].io_base + ATA_REG_STATUS) != 0xFF;
+        if (channels[c].present) {
+            ata_soft_reset(c);
+        }
+    }
+
+    // Probe for a bus-master controller (PIO is used if none is found)
+    ata_dma_init();
+
+    // Command completion is signalled on IRQ14/15 (through the cascade on IRQ2)
+    pic_clear_mask(2);
+    pic_clear_mask(14);
+    pic_clear_mask(15);
 
     // Identify drives
-    if (ata_identify(0, &drives[0])) {
-        vga_puts("ATA: Master drive: ");
-        vga_puts(drives[0].model);
+    bool found = FALSE;
+    for (uint8_t d = 0; d < ATA_MAX_DRIVES; d++) {
+        if (!ata_identify(d, &drives[d])) continue;
+        found = TRUE;
+
+        vga_puts("ATA: ");
+        vga_puts(names[d]);
+        vga_puts(": ");
+        vga_puts(drives[d].model);
         vga_puts(" (");
-        vga_put_dec(drives[0].size_sectors / 2048);  // Convert to MB
-        vga_puts(" MB)\n");
-    } else {
-        vga_puts("ATA: No master drive found\n");
+        vga_put_dec(drives[d].size_sectors >> 11);  // Convert to MB
+        vga_puts(" MB");
+        if (drives[d].lba48) {
+            vga_puts(", LBA48");
+        }
+        vga_puts(channels[d >> 1].bm_base && drives[d].dma ? ", DMA" : ", PIO");
+        vga_puts(")\n");
     }
 
-    if (ata_identify(1, &drives[1])) {
-        vga_puts("ATA: Slave drive: ");
-        vga_puts(drives[1].model);
-        vga_puts("\n");
+    if (!found) {
+        vga_puts("ATA: No drives found\n");
     }
 }
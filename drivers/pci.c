@@ -0,0 +1,71 @@
+#include "pci.h"
+#include "io.h"
+
+// Build a configuration address for mechanism #1
+static uint32_t pci_address(const struct pci_device *dev, uint8_t offset) {
+    return 0x80000000 |
+           ((uint32_t)dev->bus << 16) |
+           ((uint32_t)dev->slot << 11) |
+           ((uint32_t)dev->func << 8) |
+           (offset & 0xFC);
+}
+
+uint32_t pci_read32(const struct pci_device *dev, uint8_t offset) {
+    outl(PCI_CONFIG_ADDRESS, pci_address(dev, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint16_t pci_read16(const struct pci_device *dev, uint8_t offset) {
+    return (pci_read32(dev, offset) >> ((offset & 2) * 8)) & 0xFFFF;
+}
+
+uint8_t pci_read8(const struct pci_device *dev, uint8_t offset) {
+    return (pci_read32(dev, offset) >> ((offset & 3) * 8)) & 0xFF;
+}
+
+void pci_write32(const struct pci_device *dev, uint8_t offset, uint32_t value) {
+    outl(PCI_CONFIG_ADDRESS, pci_address(dev, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+void pci_write16(const struct pci_device *dev, uint8_t offset, uint16_t value) {
+    uint32_t shift = (offset & 2) * 8;
+    uint32_t dword = pci_read32(dev, offset);
+    dword &= ~(0xFFFF << shift);
+    dword |= (uint32_t)value << shift;
+    pci_write32(dev, offset, dword);
+}
+
+bool pci_find_class(uint8_t class_code, uint8_t subclass, struct pci_device *dev) {
+    struct pci_device d;
+
+    // Brute-force scan: 256 buses x 32 slots x 8 functions
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            for (uint8_t func = 0; func < 8; func++) {
+                d.bus = bus;
+                d.slot = slot;
+                d.func = func;
+
+                d.vendor_id = pci_read16(&d, PCI_VENDOR_ID);
+                if (d.vendor_id == 0xFFFF) {
+                    if (func == 0) break;   // No device in this slot
+                    continue;
+                }
+
+                d.class_code = pci_read8(&d, PCI_CLASS);
+                d.subclass = pci_read8(&d, PCI_SUBCLASS);
+                if (d.class_code == class_code && d.subclass == subclass) {
+                    d.device_id = pci_read16(&d, PCI_DEVICE_ID);
+                    d.prog_if = pci_read8(&d, PCI_PROG_IF);
+                    *dev = d;
+                    return TRUE;
+                }
+
+                // Only probe other functions on multi-function devices
+                if (func == 0 && !(pci_read8(&d, PCI_HEADER_TYPE) & 0x80)) break;
+            }
+        }
+    }
+    return FALSE;
+}
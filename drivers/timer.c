@@ -0,0 +1,24 @@
+#include "timer.h"
+#include "io.h"
+#include "pic.h"
+
+static volatile uint32_t ticks = 0;
+
+void timer_init(uint32_t hz) {
+    uint32_t divisor = PIT_BASE_FREQ / hz;
+
+    outb(PIT_COMMAND, PIT_MODE_RATE);
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+
+    // Enable timer IRQ (IRQ0)
+    pic_clear_mask(0);
+}
+
+void timer_handler(void) {
+    ticks++;
+}
+
+uint32_t timer_get_ticks(void) {
+    return ticks;
+}
@@ -0,0 +1,351 @@
+#include "bcache.h"
+#include "string.h"
+
+static struct bcache_buf bufs[BCACHE_BUFFERS];
+static int16_t buckets[BCACHE_HASH_SIZE];
+static int16_t lru_head;            // Most recently used
+static int16_t lru_tail;            // Least recently used
+static struct bcache_stats stats;
+
+// Staging area for coalescing adjacent dirty sectors into one command
+static uint8_t stage[BCACHE_STAGE_BLOCKS * BCACHE_BLOCK_SIZE];
+
+static uint32_t hash(uint8_t drive, uint32_t lba) {
+    return (lba + drive) & (BCACHE_HASH_SIZE - 1);
+}
+
+static void lru_unlink(int16_t i) {
+    if (bufs[i].lru_prev != BCACHE_NONE) bufs[bufs[i].lru_prev].lru_next = bufs[i].lru_next;
+    else lru_head = bufs[i].lru_next;
+
+    if (bufs[i].lru_next != BCACHE_NONE) bufs[bufs[i].lru_next].lru_prev = bufs[i].lru_prev;
+    else lru_tail = bufs[i].lru_prev;
+}
+
+static void lru_push_front(int16_t i) {
+    bufs[i].lru_prev = BCACHE_NONE;
+    bufs[i].lru_next = lru_head;
+    if (lru_head != BCACHE_NONE) bufs[lru_head].lru_prev = i;
+    lru_head = i;
+    if (lru_tail == BCACHE_NONE) lru_tail = i;
+}
+
+static void lru_push_back(int16_t i) {
+    bufs[i].lru_next = BCACHE_NONE;
+    bufs[i].lru_prev = lru_tail;
+    if (lru_tail != BCACHE_NONE) bufs[lru_tail].lru_next = i;
+    lru_tail = i;
+    if (lru_head == BCACHE_NONE) lru_head = i;
+}
+
+static int16_t lookup(uint8_t drive, uint32_t lba) {
+    for (int16_t i = buckets[hash(drive, lba)]; i != BCACHE_NONE; i = bufs[i].hash_next) {
+        if (bufs[i].lba == lba && bufs[i].drive == drive) return i;
+    }
+    return BCACHE_NONE;
+}
+
+static void hash_remove(int16_t i) {
+    int16_t *link = &buckets[hash(bufs[i].drive, bufs[i].lba)];
+    while (*link != BCACHE_NONE) {
+        if (*link == i) {
+            *link = bufs[i].hash_next;
+            return;
+        }
+        link = &bufs[*link].hash_next;
+    }
+}
+
+// Finish an outstanding readahead on a buffer; FALSE if it failed
+static bool settle(int16_t i) {
+    if (!bufs[i].loading) return TRUE;
+    bufs[i].loading = FALSE;
+    return ata_wait(&bufs[i].req);
+}
+
+// Readahead still in flight (the buffer must not be recycled yet)
+static bool busy(int16_t i) {
+    return bufs[i].loading &&
+           (bufs[i].req.status == ATA_REQ_PENDING || bufs[i].req.status == ATA_REQ_ACTIVE);
+}
+
+// Drop a buffer's identity and make it the next eviction candidate
+static void discard(int16_t i) {
+    hash_remove(i);
+    bufs[i].valid = FALSE;
+    bufs[i].dirty = FALSE;
+    bufs[i].pinned = FALSE;
+    lru_unlink(i);
+    lru_push_back(i);
+}
+
+static bool writeback(int16_t i) {
+    if (!ata_write_sectors(bufs[i].drive, bufs[i].lba, 1, bufs[i].data)) {
+        return FALSE;
+    }
+    bufs[i].dirty = FALSE;
+    stats.writebacks++;
+    return TRUE;
+}
+
+// Recycle the least recently used buffer that has no readahead in flight
+// and holds no uncommitted journal data
+static int16_t claim(void) {
+    int16_t i = lru_tail;
+    while (i != BCACHE_NONE && (busy(i) || bufs[i].pinned)) {
+        i = bufs[i].lru_prev;
+    }
+    if (i == BCACHE_NONE) return BCACHE_NONE;
+
+    if (bufs[i].valid) {
+        if (!settle(i) || !bufs[i].dirty || writeback(i)) {
+            hash_remove(i);
+            bufs[i].valid = FALSE;
+            bufs[i].dirty = FALSE;
+            stats.evictions++;
+        } else {
+            return BCACHE_NONE;     // Dirty and the write-back failed
+        }
+    }
+    return i;
+}
+
+// Give a claimed buffer its identity and make it most recently used
+static void install(int16_t i, uint8_t drive, uint32_t lba) {
+    bufs[i].drive = drive;
+    bufs[i].lba = lba;
+    bufs[i].valid = TRUE;
+    bufs[i].dirty = FALSE;
+
+    uint32_t h = hash(drive, lba);
+    bufs[i].hash_next = buckets[h];
+    buckets[h] = i;
+
+    lru_unlink(i);
+    lru_push_front(i);
+}
+
+// Find or claim a buffer for (drive, lba); fills it from disk if 'load'
+static int16_t get(uint8_t drive, uint32_t lba, bool load) {
+    int16_t i = lookup(drive, lba);
+    if (i != BCACHE_NONE && !settle(i)) {
+        discard(i);             // Readahead failed: treat as a miss
+        i = BCACHE_NONE;
+    }
+    if (i != BCACHE_NONE) {
+        stats.hits++;
+        lru_unlink(i);
+        lru_push_front(i);
+        return i;
+    }
+
+    stats.misses++;
+
+    i = claim();
+    if (i == BCACHE_NONE) {
+        return BCACHE_NONE;
+    }
+
+    if (load && !ata_read_sectors(drive, lba, 1, bufs[i].data)) {
+        lru_unlink(i);
+        lru_push_back(i);
+        return BCACHE_NONE;
+    }
+
+    install(i, drive, lba);
+    return i;
+}
+
+void bcache_init(void) {
+    mem_set(&stats, 0, sizeof(stats));
+    lru_head = BCACHE_NONE;
+    lru_tail = BCACHE_NONE;
+
+    for (int i = 0; i < BCACHE_HASH_SIZE; i++) {
+        buckets[i] = BCACHE_NONE;
+    }
+
+    for (int16_t i = 0; i < BCACHE_BUFFERS; i++) {
+        bufs[i].valid = FALSE;
+        bufs[i].dirty = FALSE;
+        bufs[i].loading = FALSE;
+        bufs[i].pinned = FALSE;
+        bufs[i].hash_next = BCACHE_NONE;
+        lru_push_back(i);
+    }
+}
+
+bool bcache_read(uint8_t drive, uint32_t lba, void *buf) {
+    int16_t i = get(drive, lba, TRUE);
+    if (i == BCACHE_NONE) return FALSE;
+
+    mem_cpy(buf, bufs[i].data, BCACHE_BLOCK_SIZE);
+    return TRUE;
+}
+
+bool bcache_write(uint8_t drive, uint32_t lba, const void *buf) {
+    // Whole-sector overwrite: no need to read the old contents
+    int16_t i = get(drive, lba, FALSE);
+    if (i == BCACHE_NONE) return FALSE;
+
+    mem_cpy(bufs[i].data, buf, BCACHE_BLOCK_SIZE);
+    bufs[i].dirty = TRUE;
+    return TRUE;
+}
+
+// Write back dirty buffers in [lba, lba + count), or all if count == 0.
+// Runs of adjacent sectors are staged and written with one command.
+static bool flush_dirty(uint8_t drive, uint32_t lba, uint32_t count) {
+    int16_t order[BCACHE_BUFFERS];
+    int n = 0;
+
+    for (int16_t i = 0; i < BCACHE_BUFFERS; i++) {
+        if (!bufs[i].valid || !bufs[i].dirty || bufs[i].pinned) continue;
+        if (count != 0 && (bufs[i].drive != drive ||
+                           bufs[i].lba < lba || bufs[i].lba - lba >= count)) continue;
+
+        // Insertion sort by (drive, lba)
+        int j = n++;
+        while (j > 0 && (bufs[order[j - 1]].drive > bufs[i].drive ||
+                         (bufs[order[j - 1]].drive == bufs[i].drive &&
+                          bufs[order[j - 1]].lba > bufs[i].lba))) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    for (int k = 0; k < n; ) {
+        int16_t first = order[k];
+        int run = 1;
+
+        while (k + run < n && run < BCACHE_STAGE_BLOCKS &&
+               bufs[order[k + run]].drive == bufs[first].drive &&
+               bufs[order[k + run]].lba == bufs[first].lba + run) {
+            run++;
+        }
+
+        if (run == 1) {
+            if (!writeback(first)) return FALSE;
+        } else {
+            for (int r = 0; r < run; r++) {
+                mem_cpy(stage + r * BCACHE_BLOCK_SIZE, bufs[order[k + r]].data, BCACHE_BLOCK_SIZE);
+            }
+            if (!ata_write_sectors(bufs[first].drive, bufs[first].lba, run, stage)) {
+                return FALSE;
+            }
+            for (int r = 0; r < run; r++) {
+                bufs[order[k + r]].dirty = FALSE;
+            }
+            stats.writebacks += run;
+        }
+
+        k += run;
+    }
+
+    return TRUE;
+}
+
+bool bcache_sync(void) {
+    return flush_dirty(0, 0, 0);
+}
+
+bool bcache_writeback_range(uint8_t drive, uint32_t lba, uint32_t count) {
+    if (count == 0) return TRUE;
+    return flush_dirty(drive, lba, count);
+}
+
+void bcache_invalidate_range(uint8_t drive, uint32_t lba, uint32_t count) {
+    for (int16_t i = 0; i < BCACHE_BUFFERS; i++) {
+        if (bufs[i].valid && bufs[i].drive == drive &&
+            bufs[i].lba >= lba && bufs[i].lba - lba < count) {
+            settle(i);      // The read must land before the buffer is reused
+            discard(i);
+        }
+    }
+}
+
+void bcache_reset(void) {
+    for (int16_t i = 0; i < BCACHE_BUFFERS; i++) {
+        if (bufs[i].valid) {
+            settle(i);      // The read must land before the buffer is reused
+            discard(i);
+        }
+    }
+}
+
+uint32_t bcache_prefetch(uint8_t drive, uint32_t lba, uint32_t count) {
+    uint32_t queued = 0;
+    uint32_t covered = 0;
+
+    ata_plug(drive);
+
+    for (uint32_t s = 0; s < count; s++) {
+        if (lookup(drive, lba + s) != BCACHE_NONE) {
+            covered++;
+            continue;
+        }
+
+        int16_t i = claim();
+        if (i == BCACHE_NONE) break;    // Everything is busy: stop early
+
+        install(i, drive, lba + s);
+
+        struct ata_request *req = &bufs[i].req;
+        req->type = ATA_REQ_READ;
+        req->drive = drive;
+        req->lba = lba + s;
+        req->count = 1;
+        req->buffer = bufs[i].data;
+        req->callback = NULL;
+        req->context = NULL;
+
+        if (!ata_submit(req)) {
+            discard(i);
+            break;
+        }
+
+        bufs[i].loading = TRUE;
+        queued++;
+        covered++;
+    }
+
+    ata_unplug(drive);
+
+    stats.prefetches += queued;
+    return covered;
+}
+
+bool bcache_read_cached(uint8_t drive, uint32_t lba, void *buf) {
+    int16_t i = lookup(drive, lba);
+    if (i == BCACHE_NONE) return FALSE;
+
+    if (!settle(i)) {
+        discard(i);
+        return FALSE;
+    }
+
+    // A streaming reader has what it came for: reuse this buffer first so the
+    // sectors still ahead of it in the readahead window stay cached
+    stats.hits++;
+    lru_unlink(i);
+    lru_push_back(i);
+    mem_cpy(buf, bufs[i].data, BCACHE_BLOCK_SIZE);
+    return TRUE;
+}
+
+bool bcache_contains(uint8_t drive, uint32_t lba) {
+    return lookup(drive, lba) != BCACHE_NONE;
+}
+
+bool bcache_pin(uint8_t drive, uint32_t lba, bool pinned) {
+    int16_t i = lookup(drive, lba);
+    if (i == BCACHE_NONE) return FALSE;
+
+    bufs[i].pinned = pinned;
+    return TRUE;
+}
+
+void bcache_get_stats(struct bcache_stats *out) {
+    mem_cpy(out, &stats, sizeof(stats));
+}
@@ -1,535 +1,3158 @@
 #include "fs.h"
+#include "vfs.h"
 #include "ata.h"
+#include "bcache.h"
 #include "vga.h"
 #include "string.h"
+#include "lz.h"
+#include "crc32c.h"
 
 static struct fs_state fs;
 
-// Helper: Read a sector
-static bool read_sector(uint32_t lba, void *buf) {
-    return ata_read_sectors(0, lba, 1, buf);
-}
-
-// Helper: Write a sector
-static bool write_sector(uint32_t lba, const void *buf) {
-    return ata_write_sectors(0, lba, 1, buf);
-}
+// Staging area for one journal transaction (header plus logged sectors)
+static uint8_t journal_buf[(1 + FS_JOURNAL_TXN_MAX) * FS_SECTOR_SIZE];
 
-// Helper: Read an inode
-static bool read_inode(uint32_t inode_num, struct inode *inode) {
-    if (inode_num >= FS_MAX_INODES) return FALSE;
+// Revokes gathered while scanning the log at mount
+static uint32_t replay_revoke_lba[FS_JOURNAL_MAX_REVOKES];
+static uint32_t replay_revoke_seq[FS_JOURNAL_MAX_REVOKES];
 
-    uint32_t sector = FS_INODE_START_SECTOR + (inode_num / 8);
-    uint32_t offset = (inode_num % 8) * sizeof(struct inode);
+// Source for zero-filling file ranges
+static uint8_t zero_buf[8 * FS_SECTOR_SIZE];
 
-    if (!read_sector(sector, fs.sector_buf)) return FALSE;
+static bool journal_commit(void);
+static bool journal_reserve(uint32_t sectors, uint32_t revokes);
+static bool csum_covers(uint32_t lba);
+static bool csum_verify(uint32_t lba, uint32_t count, const uint8_t *buf);
+static bool csum_update(uint32_t lba, uint32_t count, const uint8_t *buf);
+static void dcache_purge(uint32_t dir);
 
-    mem_cpy(inode, fs.sector_buf + offset, sizeof(struct inode));
-    return TRUE;
+// Helper: Read a sector (through the block cache)
+static bool read_sector(uint32_t lba, void *buf) {
+    return bcache_read(0, lba, buf) && csum_verify(lba, 1, buf);
 }
 
-// Helper: Write an inode
-static bool write_inode(uint32_t inode_num, const struct inode *inode) {
-    if (inode_num >= FS_MAX_INODES) return FALSE;
+// Helper: Write a metadata sector (write-back through the block cache).
+// With the journal active the sector joins the running transaction and
+// stays pinned in the cache until that transaction is committed. Room was
+// set aside by journal_reserve, so this never commits part of an operation.
+static bool write_sector(uint32_t lba, const void *buf) {
+    if (!fs.journal_active) {
+        return bcache_write(0, lba, buf) && csum_update(lba, 1, buf);
+    }
+
+    uint32_t i = 0;
+    while (i < fs.txn_count && fs.txn_lbas[i] != lba) i++;
 
-    uint32_t sector = FS_INODE_START_SECTOR + (inode_num / 8);
-    uint32_t offset = (inode_num % 8) * sizeof(struct inode);
+    // A new sector and its checksum sector must land in the same transaction
+    uint32_t need = csum_covers(lba) ? 2 : 1;
+    if (i == fs.txn_count && fs.txn_count + need > FS_JOURNAL_TXN_MAX) {
+        return FALSE;       // More than the step reserved
+    }
 
-    if (!read_sector(sector, fs.sector_buf)) return FALSE;
+    if (!bcache_write(0, lba, buf)) return FALSE;
+    bcache_pin(0, lba, TRUE);
 
-    mem_cpy(fs.sector_buf + offset, inode, sizeof(struct inode));
-    return write_sector(sector, fs.sector_buf);
-}
+    if (i == fs.txn_count) {
+        fs.txn_lbas[fs.txn_count++] = lba;
 
-// Helper: Allocate a free inode
-static int32_t alloc_inode(void) {
-    struct inode inode;
-    for (uint32_t i = 0; i < FS_MAX_INODES; i++) {
-        if (read_inode(i, &inode) && inode.type == INODE_TYPE_FREE) {
-            return i;
+        // Logged again after being freed: a revoke from earlier in this
+        // transaction would make replay skip the new copy too
+        for (uint32_t r = 0; r < fs.txn_revoke_count; ) {
+            if (fs.txn_revokes[r] == lba) {
+                fs.txn_revokes[r] = fs.txn_revokes[--fs.txn_revoke_count];
+            } else {
+                r++;
+            }
         }
     }
-    return -1;  // No free inodes
+    return csum_update(lba, 1, buf);
 }
 
-// Helper: Allocate a data block
-static uint32_t alloc_block(void) {
-    uint32_t block = fs.sb.next_free_block;
-    fs.sb.next_free_block++;
-
-    // Write updated superblock
-    mem_cpy(fs.sector_buf, &fs.sb, sizeof(struct superblock));
-    write_sector(FS_SUPERBLOCK_SECTOR, fs.sector_buf);
-
-    return block;
+// Helper: Read a run of contiguous sectors directly from disk.
+// Dirty cached copies are written back first so the disk is current.
+static bool read_sectors(uint32_t lba, uint32_t count, void *buf) {
+    if (!bcache_writeback_range(0, lba, count)) return FALSE;
+    return ata_read_sectors(0, lba, count, buf) && csum_verify(lba, count, buf);
 }
 
-// Helper: Find directory entry by name in current directory
-static bool find_entry(const char *name, struct dir_entry *entry, uint32_t *entry_sector, uint32_t *entry_offset) {
-    for (uint32_t s = 0; s < FS_DIRENTRY_SECTORS; s++) {
-        uint32_t sector = FS_DIRENTRY_START + s;
-        if (!read_sector(sector, fs.sector_buf)) continue;
+// Helper: Write a run of contiguous sectors directly to disk.
+// Cached copies of those sectors are stale afterwards and get dropped.
+// Their checksums are logged one table sector per step, so a long run
+// never overflows a transaction; a caller's own metadata comes after.
+static bool write_sectors(uint32_t lba, uint32_t count, const void *buf) {
+    const uint8_t *src = buf;
 
-        for (uint32_t i = 0; i < 8; i++) {
-            struct dir_entry *e = (struct dir_entry*)(fs.sector_buf + i * sizeof(struct dir_entry));
-            if (e->inode != 0 && e->parent_inode == fs.cwd_inode) {
-                if (str_cmp(e->name, name) == 0) {
-                    if (entry) mem_cpy(entry, e, sizeof(struct dir_entry));
-                    if (entry_sector) *entry_sector = sector;
-                    if (entry_offset) *entry_offset = i * sizeof(struct dir_entry);
-                    return TRUE;
-                }
-            }
-        }
+    if (!ata_write_sectors(0, lba, count, buf)) return FALSE;
+    bcache_invalidate_range(0, lba, count);
+    fs.data_dirty = TRUE;
+
+    while (count > 0) {
+        uint32_t run = FS_CSUMS_PER_SECTOR - lba % FS_CSUMS_PER_SECTOR;
+        if (run > count) run = count;
+        if (!journal_reserve(1, 0) || !csum_update(lba, run, src)) return FALSE;
+        lba += run;
+        count -= run;
+        src += run * FS_SECTOR_SIZE;
     }
-    return FALSE;
+    return TRUE;
 }
 
-// Helper: Find free directory entry slot
-static bool find_free_entry(uint32_t *entry_sector, uint32_t *entry_offset) {
-    for (uint32_t s = 0; s < FS_DIRENTRY_SECTORS; s++) {
-        uint32_t sector = FS_DIRENTRY_START + s;
-        if (!read_sector(sector, fs.sector_buf)) continue;
-
-        for (uint32_t i = 0; i < 8; i++) {
-            struct dir_entry *e = (struct dir_entry*)(fs.sector_buf + i * sizeof(struct dir_entry));
-            if (e->inode == 0) {
-                *entry_sector = sector;
-                *entry_offset = i * sizeof(struct dir_entry);
-                return TRUE;
-            }
-        }
+// Helper: Zero a run of sectors directly on disk, a few at a time
+static bool zero_sectors(uint32_t lba, uint32_t count) {
+    while (count > 0) {
+        uint32_t run = count;
+        if (run > sizeof(zero_buf) / FS_SECTOR_SIZE) run = sizeof(zero_buf) / FS_SECTOR_SIZE;
+        if (!write_sectors(lba, run, zero_buf)) return FALSE;
+        lba += run;
+        count -= run;
     }
-    return FALSE;
+    return TRUE;
 }
 
-void fs_init(void) {
-    fs.mounted = FALSE;
-    fs.cwd_inode = 0;
-    str_cpy(fs.cwd_path, "/");
+// Helper: Check whether a sector has an entry in the checksum table. The
+// superblock and the table itself do not.
+static bool csum_covers(uint32_t lba) {
+    return fs.csum_active && lba != FS_SUPERBLOCK_SECTOR && lba < fs.sb.total_sectors &&
+           (lba < fs.sb.csum_start || lba >= fs.sb.csum_start + fs.sb.csum_sectors);
+}
 
-    // Try to mount existing filesystem
-    if (!fs_mount()) {
-        vga_puts("[*] No filesystem found. Use 'format' to create one.\n");
-    }
+// Helper: Checksum of one sector as recorded; 0 is kept for "none"
+static uint32_t sector_csum(const uint8_t *buf) {
+    uint32_t crc = crc32c(0, buf, FS_SECTOR_SIZE);
+    return crc != 0 ? crc : 1;
 }
 
-bool fs_format(void) {
-    // Initialize superblock
-    mem_set(&fs.sb, 0, sizeof(struct superblock));
-    fs.sb.magic = FS_MAGIC;
-    fs.sb.version = FS_VERSION;
-    fs.sb.total_sectors = 20480;  // 10MB
-    fs.sb.inode_count = FS_MAX_INODES;
-    fs.sb.inode_start = FS_INODE_START_SECTOR;
-    fs.sb.direntry_start = FS_DIRENTRY_START;
-    fs.sb.data_start = FS_DATA_START_SECTOR;
-    fs.sb.free_inodes = FS_MAX_INODES - 1;  // Root uses 1
-    fs.sb.root_inode = 0;
-    fs.sb.next_free_block = FS_DATA_START_SECTOR;
+// Helper: Load checksum table sector 'sector' into csum_buf
+static bool csum_load(uint32_t sector) {
+    if (fs.csum_sector == (int32_t)sector) return TRUE;
 
-    // Write superblock
-    mem_set(fs.sector_buf, 0, FS_SECTOR_SIZE);
-    mem_cpy(fs.sector_buf, &fs.sb, sizeof(struct superblock));
-    if (!write_sector(FS_SUPERBLOCK_SECTOR, fs.sector_buf)) {
+    if (!read_sector(fs.sb.csum_start + sector, fs.csum_buf)) {
+        fs.csum_sector = -1;
         return FALSE;
     }
+    fs.csum_sector = sector;
+    return TRUE;
+}
 
-    // Clear inode table
-    mem_set(fs.sector_buf, 0, FS_SECTOR_SIZE);
-    for (uint32_t i = 0; i < FS_INODE_SECTORS; i++) {
-        if (!write_sector(FS_INODE_START_SECTOR + i, fs.sector_buf)) {
+// Helper: Check sectors just read against the table. Sectors never written
+// since checksums were turned on have no entry and pass unchecked.
+static bool csum_verify(uint32_t lba, uint32_t count, const uint8_t *buf) {
+    for (uint32_t i = 0; i < count; i++, buf += FS_SECTOR_SIZE) {
+        if (!csum_covers(lba + i)) continue;
+        if (!csum_load((lba + i) / FS_CSUMS_PER_SECTOR)) return FALSE;
+
+        uint32_t want = fs.csum_buf[(lba + i) % FS_CSUMS_PER_SECTOR];
+        if (want == 0) {
+            fs.csum_stats.unrecorded++;
+            continue;
+        }
+        if (sector_csum(buf) != want) {
+            fs.csum_stats.mismatches++;
+            fs.csum_stats.last_bad = lba + i;
+            vga_puts("[!] Checksum mismatch in sector ");
+            vga_put_dec(lba + i);
+            vga_putchar('\n');
             return FALSE;
         }
+        fs.csum_stats.verified++;
     }
+    return TRUE;
+}
 
-    // Create root directory inode
-    struct inode root_inode;
-    mem_set(&root_inode, 0, sizeof(struct inode));
-    root_inode.type = INODE_TYPE_DIR;
-    root_inode.size = 0;
-    root_inode.parent_inode = 0;  // Root is its own parent
-    if (!write_inode(0, &root_inode)) {
-        return FALSE;
-    }
-
-    // Clear directory entries
-    mem_set(fs.sector_buf, 0, FS_SECTOR_SIZE);
-    for (uint32_t i = 0; i < FS_DIRENTRY_SECTORS; i++) {
-        if (!write_sector(FS_DIRENTRY_START + i, fs.sector_buf)) {
+// Helper: Record the checksums of sectors just written, one table sector
+// write per table sector touched
+static bool csum_update(uint32_t lba, uint32_t count, const uint8_t *buf) {
+    uint32_t end = lba + count;
+
+    while (lba < end) {
+        uint32_t sector = lba / FS_CSUMS_PER_SECTOR;
+        uint32_t stop = (sector + 1) * FS_CSUMS_PER_SECTOR;
+        bool changed = FALSE;
+        if (stop > end) stop = end;
+
+        for (; lba < stop; lba++, buf += FS_SECTOR_SIZE) {
+            if (!csum_covers(lba)) continue;
+            if (!csum_load(sector)) return FALSE;
+
+            uint32_t crc = sector_csum(buf);
+            if (fs.csum_buf[lba % FS_CSUMS_PER_SECTOR] != crc) {
+                fs.csum_buf[lba % FS_CSUMS_PER_SECTOR] = crc;
+                changed = TRUE;
+            }
+        }
+        if (changed && !write_sector(fs.sb.csum_start + sector, fs.csum_buf)) {
+            fs.csum_sector = -1;
             return FALSE;
         }
     }
+    return TRUE;
+}
+
+// Helper: FNV-1a over a buffer, continuing from 'h'
+static uint32_t fnv1a(uint32_t h, const uint8_t *p, uint32_t len) {
+    while (len--) {
+        h ^= *p++;
+        h *= 16777619u;
+    }
+    return h;
+}
 
-    // Mount the new filesystem
-    fs.mounted = TRUE;
-    fs.cwd_inode = 0;
-    str_cpy(fs.cwd_path, "/");
+// Helper: Drop the running transaction without committing it
+static void journal_abort(void) {
+    for (uint32_t i = 0; i < fs.txn_count; i++) {
+        bcache_pin(0, fs.txn_lbas[i], FALSE);
+    }
+    fs.txn_count = 0;
+    fs.txn_revoke_count = 0;
+    fs.journal_active = FALSE;
+}
+
+// Helper: Write committed metadata home and restart the log at its first
+// sector. Pinned sectors are skipped by the write-back, so this must only
+// run with no transaction pinned.
+static bool journal_checkpoint(void) {
+    if (!bcache_sync() || !ata_flush(0)) return FALSE;
 
+    struct journal_super *js = (struct journal_super*)journal_buf;
+    mem_set(js, 0, FS_SECTOR_SIZE);
+    js->magic = FS_JOURNAL_MAGIC;
+    js->sequence = fs.journal_seq;
+    if (!ata_write_sectors(0, fs.sb.journal_start, 1, js) || !ata_flush(0)) return FALSE;
+
+    fs.journal_head = 0;
+    fs.journal_revokes = 0;
     return TRUE;
 }
 
-bool fs_mount(void) {
-    // Read superblock
-    if (!read_sector(FS_SUPERBLOCK_SECTOR, fs.sector_buf)) {
-        return FALSE;
+// Helper: Commit the running transaction: its sectors go to the log in one
+// command and become durable; writing them home is left for a checkpoint
+static bool journal_commit(void) {
+    if (fs.txn_count == 0 && fs.txn_revoke_count == 0) {
+        if (fs.data_dirty && !ata_flush(0)) return FALSE;
+        fs.data_dirty = FALSE;
+        return TRUE;
     }
 
-    mem_cpy(&fs.sb, fs.sector_buf, sizeof(struct superblock));
-
-    // Verify magic number
-    if (fs.sb.magic != FS_MAGIC) {
+    // The last commit left room for a whole transaction (see below)
+    uint32_t need = 1 + fs.txn_count;
+    if (fs.journal_head + need > fs.sb.journal_sectors - 1 ||
+        fs.journal_revokes + fs.txn_revoke_count > FS_JOURNAL_MAX_REVOKES) {
         return FALSE;
     }
 
-    fs.mounted = TRUE;
-    fs.cwd_inode = fs.sb.root_inode;
-    str_cpy(fs.cwd_path, "/");
+    // Ordered mode: data the new metadata points at must be on disk first
+    if (fs.data_dirty && !ata_flush(0)) return FALSE;
+    fs.data_dirty = FALSE;
+
+    struct journal_header *h = (struct journal_header*)journal_buf;
+    mem_set(h, 0, FS_SECTOR_SIZE);
+    h->magic = FS_JOURNAL_MAGIC;
+    h->sequence = fs.journal_seq;
+    h->count = fs.txn_count;
+    h->revoke_count = fs.txn_revoke_count;
+    mem_cpy(h->lbas, fs.txn_lbas, fs.txn_count * sizeof(uint32_t));
+    mem_cpy(h->lbas + fs.txn_count, fs.txn_revokes, fs.txn_revoke_count * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < fs.txn_count; i++) {
+        if (!bcache_read(0, fs.txn_lbas[i], journal_buf + (1 + i) * FS_SECTOR_SIZE)) return FALSE;
+    }
+    h->checksum = fnv1a(2166136261u, journal_buf, need * FS_SECTOR_SIZE);
 
+    uint32_t lba = fs.sb.journal_start + 1 + fs.journal_head;
+    if (!ata_write_sectors(0, lba, need, journal_buf) || !ata_flush(0)) return FALSE;
+
+    // Committed: the cache may now write these sectors home whenever it likes
+    for (uint32_t i = 0; i < fs.txn_count; i++) {
+        bcache_pin(0, fs.txn_lbas[i], FALSE);
+    }
+
+    fs.journal_head += need;
+    fs.journal_revokes += fs.txn_revoke_count;
+    fs.journal_seq++;
+    fs.txn_count = 0;
+    fs.txn_revoke_count = 0;
+
+    // Restart the log now if the next transaction might not fit. Nothing is
+    // pinned at this point, so the checkpoint can write every committed
+    // sector home before the log copies are dropped.
+    if (fs.journal_head + 1 + FS_JOURNAL_TXN_MAX > fs.sb.journal_sectors - 1 ||
+        fs.journal_revokes + FS_JOURNAL_TXN_REVOKES > FS_JOURNAL_MAX_REVOKES) {
+        return journal_checkpoint();
+    }
     return TRUE;
 }
 
-bool fs_is_mounted(void) {
-    return fs.mounted;
-}
+// Helper: A metadata sector is being freed (and may come back as data), so
+// older logged copies of it must never be replayed. Right after a
+// checkpoint the log holds none, and no revoke is needed.
+static bool journal_revoke(uint32_t lba) {
+    if (!fs.journal_active) return TRUE;
+
+    for (uint32_t i = 0; i < fs.txn_count; i++) {
+        if (fs.txn_lbas[i] == lba) {
+            bcache_pin(0, lba, FALSE);
+            fs.txn_lbas[i] = fs.txn_lbas[--fs.txn_count];
+            break;
+        }
+    }
 
-const char* fs_get_cwd(void) {
-    return fs.cwd_path;
+    if (fs.journal_head == 0) return TRUE;
+    if (fs.txn_revoke_count == FS_JOURNAL_TXN_REVOKES) return FALSE;   // More than the step reserved
+    fs.txn_revokes[fs.txn_revoke_count++] = lba;
+    return TRUE;
 }
 
-uint32_t fs_get_cwd_inode(void) {
-    return fs.cwd_inode;
-}
+// Helper: Read and validate the transaction at log sector 'pos' into journal_buf
+static bool journal_read_txn(uint32_t pos, uint32_t sequence) {
+    struct journal_header *h = (struct journal_header*)journal_buf;
+    uint32_t lba = fs.sb.journal_start + 1 + pos;
 
-bool fs_mkdir(const char *name) {
-    if (!fs.mounted) return FALSE;
-    if (str_len(name) >= FS_MAX_FILENAME) return FALSE;
+    if (pos + 1 > fs.sb.journal_sectors - 1) return FALSE;
+    if (!ata_read_sectors(0, lba, 1, journal_buf)) return FALSE;
 
-    // Check if already exists
-    if (find_entry(name, NULL, NULL, NULL)) {
+    if (h->magic != FS_JOURNAL_MAGIC || h->sequence != sequence ||
+        h->count > FS_JOURNAL_TXN_MAX || h->revoke_count > FS_JOURNAL_TXN_REVOKES ||
+        pos + 1 + h->count > fs.sb.journal_sectors - 1) {
         return FALSE;
     }
 
-    // Allocate inode
-    int32_t new_inode = alloc_inode();
-    if (new_inode < 0) return FALSE;
-
-    // Create inode
-    struct inode inode;
-    mem_set(&inode, 0, sizeof(struct inode));
-    inode.type = INODE_TYPE_DIR;
-    inode.size = 0;
-    inode.parent_inode = fs.cwd_inode;
-    if (!write_inode(new_inode, &inode)) {
+    if (h->count > 0 && !ata_read_sectors(0, lba + 1, h->count, journal_buf + FS_SECTOR_SIZE)) {
         return FALSE;
     }
 
-    // Find free directory entry
-    uint32_t entry_sector, entry_offset;
-    if (!find_free_entry(&entry_sector, &entry_offset)) {
+    uint32_t checksum = h->checksum;
+    h->checksum = 0;
+    return fnv1a(2166136261u, journal_buf, (1 + h->count) * FS_SECTOR_SIZE) == checksum;
+}
+
+// Helper: Replay committed transactions after an unclean shutdown. The first
+// pass finds the end of the log and its revokes, the second writes home
+// every logged sector that no later transaction revoked.
+static bool journal_replay(void) {
+    struct journal_super js;
+    if (!ata_read_sectors(0, fs.sb.journal_start, 1, &js) || js.magic != FS_JOURNAL_MAGIC) {
         return FALSE;
     }
 
-    // Create directory entry
-    if (!read_sector(entry_sector, fs.sector_buf)) {
-        return FALSE;
+    struct journal_header *h = (struct journal_header*)journal_buf;
+    uint32_t revokes = 0;
+    uint32_t pos = 0;
+    uint32_t seq = js.sequence;
+
+    while (journal_read_txn(pos, seq)) {
+        if (revokes + h->revoke_count > FS_JOURNAL_MAX_REVOKES) break;
+        for (uint32_t r = 0; r < h->revoke_count; r++) {
+            replay_revoke_lba[revokes] = h->lbas[h->count + r];
+            replay_revoke_seq[revokes] = seq;
+            revokes++;
+        }
+        pos += 1 + h->count;
+        seq++;
     }
 
-    struct dir_entry *entry = (struct dir_entry*)(fs.sector_buf + entry_offset);
-    mem_set(entry, 0, sizeof(struct dir_entry));
-    entry->inode = new_inode;
-    entry->parent_inode = fs.cwd_inode;
-    entry->type = INODE_TYPE_DIR;
-    entry->name_len = str_len(name);
-    str_ncpy(entry->name, name, FS_MAX_FILENAME - 1);
+    uint32_t end_seq = seq;
+    pos = 0;
+    for (seq = js.sequence; seq != end_seq; seq++) {
+        if (!journal_read_txn(pos, seq)) return FALSE;
+
+        for (uint32_t i = 0; i < h->count; i++) {
+            bool revoked = FALSE;
+            for (uint32_t r = 0; r < revokes; r++) {
+                if (replay_revoke_lba[r] == h->lbas[i] && replay_revoke_seq[r] >= seq) {
+                    revoked = TRUE;
+                    break;
+                }
+            }
+            if (!revoked && !write_sectors(h->lbas[i], 1, journal_buf + (1 + i) * FS_SECTOR_SIZE)) {
+                return FALSE;
+            }
+        }
+        pos += 1 + h->count;
+    }
 
-    return write_sector(entry_sector, fs.sector_buf);
+    // Start an empty log after what was replayed
+    fs.journal_seq = end_seq;
+    return journal_checkpoint();
 }
 
-bool fs_chdir(const char *name) {
-    if (!fs.mounted) return FALSE;
+// Helper: Start journaling metadata on a mounted volume
+static void journal_open(void) {
+    fs.txn_count = 0;
+    fs.txn_revoke_count = 0;
+    fs.data_dirty = FALSE;
+    fs.journal_active = fs.sb.journal_sectors > 1;
+}
 
-    // Handle root
-    if (str_cmp(name, "/") == 0) {
-        fs.cwd_inode = fs.sb.root_inode;
-        str_cpy(fs.cwd_path, "/");
+// Helper: Extent 'idx' of an inode; spilled extents live in the indirect sector
+static bool get_extent(const struct inode *inode, uint32_t idx, struct fs_extent *ext) {
+    if (idx < FS_INODE_EXTENTS) {
+        *ext = inode->extents[idx];
         return TRUE;
     }
+    if (inode->indirect == 0 || idx >= FS_MAX_EXTENTS) return FALSE;
 
-    // Handle parent directory
-    if (str_cmp(name, "..") == 0) {
-        if (fs.cwd_inode == fs.sb.root_inode) {
-            return TRUE;  // Already at root
-        }
-
-        struct inode inode;
-        if (!read_inode(fs.cwd_inode, &inode)) {
+    if (fs.ext_sector != inode->indirect) {
+        if (!read_sector(inode->indirect, fs.ext_buf)) {
+            fs.ext_sector = 0;
             return FALSE;
         }
-
-        fs.cwd_inode = inode.parent_inode;
-
-        // Update path
-        if (fs.cwd_inode == fs.sb.root_inode) {
-            str_cpy(fs.cwd_path, "/");
-        } else {
-            // Remove last component from path
-            char *last_slash = str_rchr(fs.cwd_path, '/');
-            if (last_slash && last_slash != fs.cwd_path) {
-                *last_slash = '\0';
-            } else {
-                str_cpy(fs.cwd_path, "/");
-            }
-        }
-        return TRUE;
+        fs.ext_sector = inode->indirect;
     }
+    *ext = fs.ext_buf[idx - FS_INODE_EXTENTS];
+    return TRUE;
+}
 
-    // Find directory
-    struct dir_entry entry;
-    if (!find_entry(name, &entry, NULL, NULL)) {
-        return FALSE;
-    }
+// Helper: Map file sector 'block' to its LBA. Returns how many sectors from
+// there on are physically contiguous (capped at 'end'), 0 if unmapped.
+static uint32_t map_block(const struct inode *inode, uint32_t block, uint32_t end, uint32_t *lba) {
+    uint32_t base = 0;
+    struct fs_extent ext;
 
-    if (entry.type != INODE_TYPE_DIR) {
-        return FALSE;  // Not a directory
-    }
+    for (uint32_t i = 0; i < inode->extent_count; i++) {
+        if (!get_extent(inode, i, &ext)) return 0;
 
-    fs.cwd_inode = entry.inode;
+        uint32_t sectors = ext.length * fs.sb.cluster_sectors;
+        if (block < base + sectors) {
+            uint32_t offset = block - base;
+            uint32_t run = sectors - offset;
+            if (run > end - block) run = end - block;
 
-    // Update path
-    if (str_cmp(fs.cwd_path, "/") != 0) {
-        str_cat(fs.cwd_path, "/");
+            *lba = ext.start + offset;
+            return run;
+        }
+        base += sectors;
     }
-    str_cat(fs.cwd_path, name);
-
-    return TRUE;
+    return 0;
 }
 
-bool fs_list_dir(void) {
-    if (!fs.mounted) return FALSE;
-
-    bool found_any = FALSE;
+// Helper: Readahead slot for a file, recycling the least recently used one
+static struct fs_readahead *ra_get(uint32_t inode_num) {
+    struct fs_readahead *victim = &fs.ra[0];
 
-    for (uint32_t s = 0; s < FS_DIRENTRY_SECTORS; s++) {
-        uint32_t sector = FS_DIRENTRY_START + s;
-        if (!read_sector(sector, fs.sector_buf)) continue;
+    fs.ra_clock++;
+    for (uint32_t i = 0; i < FS_RA_SLOTS; i++) {
+        struct fs_readahead *ra = &fs.ra[i];
+        if (ra->used && ra->inode == inode_num) {
+            ra->last_used = fs.ra_clock;
+            return ra;
+        }
+        if (!ra->used || (victim->used && ra->last_used < victim->last_used)) {
+            victim = ra;
+        }
+    }
 
-        for (uint32_t i = 0; i < 8; i++) {
-            struct dir_entry *e = (struct dir_entry*)(fs.sector_buf + i * sizeof(struct dir_entry));
-            if (e->inode != 0 && e->parent_inode == fs.cwd_inode) {
-                found_any = TRUE;
+    victim->used = TRUE;
+    victim->inode = inode_num;
+    victim->next_block = 0;
+    victim->window = FS_RA_MIN_BLOCKS;
+    victim->last_used = fs.ra_clock;
+    return victim;
+}
 
-                if (e->type == INODE_TYPE_DIR) {
-                    vga_set_color(VGA_LIGHT_BLUE, VGA_BLACK);
-                    vga_puts("  [DIR]  ");
-                } else {
-                    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
-                    vga_puts("  [FILE] ");
-                }
+// Helper: Forget readahead state for a file whose blocks changed
+static void ra_forget(uint32_t inode_num) {
+    for (uint32_t i = 0; i < FS_RA_SLOTS; i++) {
+        if (fs.ra[i].used && fs.ra[i].inode == inode_num) {
+            fs.ra[i].used = FALSE;
+        }
+    }
+}
 
-                vga_puts(e->name);
+// Helper: Note a read of blocks [first, first + count) and prefetch what a
+// sequential reader will want next. The window doubles on each sequential
+// read up to the cap and drops back to the minimum on a seek.
+static void readahead(struct fs_readahead *ra, const struct inode *inode,
+                      uint32_t first, uint32_t count, uint32_t blocks) {
+    if (first == ra->next_block) {
+        if (first != 0 && ra->window < FS_RA_MAX_BLOCKS) ra->window *= 2;
+    } else {
+        ra->window = FS_RA_MIN_BLOCKS;
+    }
+    ra->next_block = first + count;
+
+    uint32_t start = first + count;
+    uint32_t end = start + ra->window;
+    if (end > blocks) end = blocks;
+
+    // Queue the window as async reads, one contiguous run per prefetch; the
+    // driver gets each run whole and sends it as one command
+    for (uint32_t i = start; i < end; ) {
+        uint32_t lba;
+        uint32_t run = map_block(inode, i, end, &lba);
+        if (run == 0 || bcache_prefetch(0, lba, run) < run) return;
+        i += run;
+    }
+}
 
-                // Show file size for files
-                if (e->type == INODE_TYPE_FILE) {
-                    struct inode inode;
-                    if (read_inode(e->inode, &inode)) {
-                        vga_puts(" (");
-                        vga_put_dec(inode.size);
-                        vga_puts(" bytes)");
-                    }
-                }
+// Helper: Read whole file blocks [first, first + count) into dst.
+// Blocks already cached (typically by readahead) are copied from the cache,
+// the rest are read straight from disk in contiguous runs.
+static bool read_blocks(const struct inode *inode, uint32_t first, uint32_t count, uint8_t *dst) {
+    uint32_t end = first + count;
+
+    for (uint32_t i = first; i < end; ) {
+        uint32_t lba;
+        uint32_t run = map_block(inode, i, end, &lba);
+        if (run == 0) return FALSE;
+
+        if (bcache_read_cached(0, lba, dst)) {
+            if (!csum_verify(lba, 1, dst)) return FALSE;
+            dst += FS_SECTOR_SIZE;
+            i++;
+            continue;
+        }
 
-                vga_putchar('\n');
+        for (uint32_t k = 1; k < run; k++) {
+            if (bcache_contains(0, lba + k)) {
+                run = k;
+                break;
             }
         }
-    }
-
-    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
 
-    if (!found_any) {
-        vga_puts("  (empty directory)\n");
+        if (!read_sectors(lba, run, dst)) return FALSE;
+        dst += run * FS_SECTOR_SIZE;
+        i += run;
     }
-
     return TRUE;
 }
 
-bool fs_create(const char *name) {
-    if (!fs.mounted) return FALSE;
-    if (str_len(name) >= FS_MAX_FILENAME) return FALSE;
-
-    // Check if already exists
-    if (find_entry(name, NULL, NULL, NULL)) {
-        return FALSE;
+// Helper: Write whole file blocks [first, first + count) from src, one
+// command per contiguous run
+static bool write_blocks(const struct inode *inode, uint32_t first, uint32_t count, const uint8_t *src) {
+    uint32_t end = first + count;
+
+    for (uint32_t i = first; i < end; ) {
+        uint32_t lba;
+        uint32_t run = map_block(inode, i, end, &lba);
+        if (run == 0 || !write_sectors(lba, run, src)) return FALSE;
+        src += run * FS_SECTOR_SIZE;
+        i += run;
     }
+    return TRUE;
+}
 
-    // Allocate inode
-    int32_t new_inode = alloc_inode();
-    if (new_inode < 0) return FALSE;
+// Helper: Write the in-memory superblock (through the cache). It is exactly
+// one sector, so no staging buffer is needed and callers may hold sector_buf.
+static bool write_super(void) {
+    return write_sector(FS_SUPERBLOCK_SECTOR, &fs.sb);
+}
 
-    // Create inode
-    struct inode inode;
-    mem_set(&inode, 0, sizeof(struct inode));
-    inode.type = INODE_TYPE_FILE;
-    inode.size = 0;
-    inode.parent_inode = fs.cwd_inode;
-    if (!write_inode(new_inode, &inode)) {
+// Helper: Write back the inode bitmap window, and the free count with it
+static bool imap_flush(void) {
+    if (!fs.imap_dirty) return TRUE;
+    if (!write_sector(fs.sb.inode_bitmap_start + fs.imap_sector, fs.imap_buf) ||
+        !write_super()) {
         return FALSE;
     }
+    fs.imap_dirty = FALSE;
+    return TRUE;
+}
 
-    // Find free directory entry
-    uint32_t entry_sector, entry_offset;
-    if (!find_free_entry(&entry_sector, &entry_offset)) {
+// Helper: Bring inode bitmap sector 'sector' into the window
+static bool imap_load(uint32_t sector) {
+    if (fs.imap_sector == (int32_t)sector) return TRUE;
+    if (!imap_flush()) return FALSE;
+    if (!read_sector(fs.sb.inode_bitmap_start + sector, fs.imap_buf)) {
+        fs.imap_sector = -1;
         return FALSE;
     }
+    fs.imap_sector = sector;
+    return TRUE;
+}
 
-    // Create directory entry
-    if (!read_sector(entry_sector, fs.sector_buf)) {
-        return FALSE;
+// Helper: Mark an inode used or free, keeping free_inodes exact.
+// Volumes still being upgraded to v8 have no bitmap yet.
+static bool imap_set(uint32_t inode_num, bool used) {
+    if (fs.sb.inode_bitmap_sectors == 0) return TRUE;
+    if (!imap_load(inode_num / FS_BITS_PER_SECTOR)) return FALSE;
+
+    uint32_t *word = &fs.imap_buf[(inode_num % FS_BITS_PER_SECTOR) / 32];
+    uint32_t bit = 1u << (inode_num % 32);
+    if (((*word & bit) != 0) == used) return TRUE;
+
+    if (used) {
+        *word |= bit;
+        fs.sb.free_inodes--;
+    } else {
+        *word &= ~bit;
+        fs.sb.free_inodes++;
+        if (inode_num < fs.imap_hint) fs.imap_hint = inode_num;
     }
-
-    struct dir_entry *entry = (struct dir_entry*)(fs.sector_buf + entry_offset);
-    mem_set(entry, 0, sizeof(struct dir_entry));
-    entry->inode = new_inode;
-    entry->parent_inode = fs.cwd_inode;
-    entry->type = INODE_TYPE_FILE;
-    entry->name_len = str_len(name);
-    str_ncpy(entry->name, name, FS_MAX_FILENAME - 1);
-
-    return write_sector(entry_sector, fs.sector_buf);
+    fs.imap_dirty = TRUE;
+    return TRUE;
 }
 
-bool fs_exists(const char *name) {
-    return find_entry(name, NULL, NULL, NULL);
-}
+// Helper: Read an inode (through the block cache)
+static bool read_inode(uint32_t inode_num, struct inode *inode) {
+    if (inode_num >= fs.sb.inode_count) return FALSE;
 
-bool fs_open(const char *name, uint32_t *inode_num) {
-    struct dir_entry entry;
-    if (!find_entry(name, &entry, NULL, NULL)) {
+    if (!read_sector(fs.sb.inode_start + inode_num / FS_INODES_PER_SECTOR, fs.inode_buf)) {
         return FALSE;
     }
-    *inode_num = entry.inode;
+    mem_cpy(inode, fs.inode_buf + (inode_num % FS_INODES_PER_SECTOR) * sizeof(struct inode),
+            sizeof(struct inode));
     return TRUE;
 }
 
-bool fs_read(uint32_t inode_num, void *buf, uint32_t *size) {
-    struct inode inode;
-    if (!read_inode(inode_num, &inode)) {
-        return FALSE;
-    }
+// Helper: Write an inode into its table sector and track its free bit
+static bool write_inode(uint32_t inode_num, const struct inode *inode) {
+    if (inode_num >= fs.sb.inode_count) return FALSE;
 
-    if (inode.type != INODE_TYPE_FILE) {
-        return FALSE;
-    }
+    uint32_t lba = fs.sb.inode_start + inode_num / FS_INODES_PER_SECTOR;
+    if (!read_sector(lba, fs.inode_buf)) return FALSE;
 
-    *size = inode.size;
-    if (*size == 0) return TRUE;
+    mem_cpy(fs.inode_buf + (inode_num % FS_INODES_PER_SECTOR) * sizeof(struct inode),
+            inode, sizeof(struct inode));
+    if (!write_sector(lba, fs.inode_buf)) return FALSE;
+    return imap_set(inode_num, inode->type != INODE_TYPE_FREE);
+}
 
-    uint8_t *dst = buf;
-    uint32_t remaining = inode.size;
+// Helper: Allocate a free inode (first clear bit in the inode bitmap).
+// Whole words in use are skipped at once.
+static int32_t alloc_inode(void) {
+    if (fs.sb.free_inodes == 0) return -1;  // No free inodes
 
-    for (uint32_t i = 0; i < inode.block_count && remaining > 0; i++) {
-        if (!read_sector(inode.blocks[i], fs.sector_buf)) {
-            return FALSE;
-        }
+    for (uint32_t i = fs.imap_hint & ~31u; i < fs.sb.inode_count; i += 32) {
+        if (!imap_load(i / FS_BITS_PER_SECTOR)) return -1;
 
-        uint32_t to_copy = remaining > FS_SECTOR_SIZE ? FS_SECTOR_SIZE : remaining;
-        mem_cpy(dst, fs.sector_buf, to_copy);
-        dst += to_copy;
-        remaining -= to_copy;
+        uint32_t word = ~fs.imap_buf[(i % FS_BITS_PER_SECTOR) / 32];
+        if (word != 0) {
+            uint32_t n = i + __builtin_ctz(word);
+            if (n >= fs.sb.inode_count) break;
+            fs.imap_hint = n;
+            return n;
+        }
     }
-
-    return TRUE;
+    return -1;
 }
 
-bool fs_write(uint32_t inode_num, const void *buf, uint32_t size) {
-    struct inode inode;
-    if (!read_inode(inode_num, &inode)) {
+// Helper: Write back the bitmap window if it was modified, and the free
+// count and allocation cursor with it
+static bool bmap_flush(void) {
+    if (!fs.bmap_dirty) return TRUE;
+    if (!write_sector(fs.sb.bitmap_start + fs.bmap_sector, fs.bmap_buf) ||
+        !write_super()) {
         return FALSE;
     }
+    fs.bmap_dirty = FALSE;
+    return TRUE;
+}
 
-    if (inode.type != INODE_TYPE_FILE) {
+// Helper: Bring bitmap sector 'sector' into the window
+static bool bmap_load(uint32_t sector) {
+    if (fs.bmap_sector == (int32_t)sector) return TRUE;
+    if (!bmap_flush()) return FALSE;
+    if (!read_sector(fs.sb.bitmap_start + sector, fs.bmap_buf)) {
+        fs.bmap_sector = -1;
         return FALSE;
     }
+    fs.bmap_sector = sector;
+    return TRUE;
+}
 
-    // Calculate blocks needed
-    uint32_t blocks_needed = (size + FS_SECTOR_SIZE - 1) / FS_SECTOR_SIZE;
-    if (blocks_needed > FS_DIRECT_BLOCKS) {
-        return FALSE;  // File too large
-    }
-
-    // Allocate new blocks if needed
-    while (inode.block_count < blocks_needed) {
-        inode.blocks[inode.block_count] = alloc_block();
-        inode.block_count++;
+// Helper: Start the next step of an operation: one that leaves the volume
+// consistent and logs up to 'sectors' sectors and 'revokes' revokes. The
+// bitmap windows the step before changed are logged first. If the running
+// transaction lacks the room it is committed now, so a step never spans
+// two; apart from fs_sync this is the only place a transaction is
+// committed. Revokes a transaction cannot hold are avoided by emptying
+// the log, which leaves no older copy to revoke.
+static bool journal_reserve(uint32_t sectors, uint32_t revokes) {
+    if (!imap_flush() || !bmap_flush()) return FALSE;
+    if (!fs.journal_active) return TRUE;
+
+    if (fs.txn_count + sectors <= FS_JOURNAL_TXN_MAX &&
+        fs.txn_revoke_count + revokes <= FS_JOURNAL_TXN_REVOKES) {
+        return TRUE;
     }
+    if (!journal_commit()) return FALSE;
+    return revokes <= FS_JOURNAL_TXN_REVOKES || fs.journal_head == 0 || journal_checkpoint();
+}
 
-    // Write data
-    const uint8_t *src = buf;
-    uint32_t remaining = size;
+// Helper: First block index in [from, end) whose bit equals 'used' ('end' if none).
+// Whole words of the wrong value are skipped at once.
+static uint32_t bmap_find(uint32_t from, uint32_t end, bool used) {
 
-    for (uint32_t i = 0; i < blocks_needed; i++) {
-        uint32_t to_write = remaining > FS_SECTOR_SIZE ? FS_SECTOR_SIZE : remaining;
+    while (from < end) {
+        if (!bmap_load(from / FS_BITS_PER_SECTOR)) return end;
 
-        mem_set(fs.sector_buf, 0, FS_SECTOR_SIZE);
-        mem_cpy(fs.sector_buf, src, to_write);
+        uint32_t word = fs.bmap_buf[(from % FS_BITS_PER_SECTOR) / 32];
+        if (!used) word = ~word;
+        word &= ~0u << (from % 32);
 
-        if (!write_sector(inode.blocks[i], fs.sector_buf)) {
-            return FALSE;
+        if (word != 0) {
+            uint32_t b = (from & ~31u) + __builtin_ctz(word);
+            return b < end ? b : end;
         }
-
-        src += to_write;
-        remaining -= to_write;
+        from = (from & ~31u) + 32;
     }
-
-    // Update inode
-    inode.size = size;
-    return write_inode(inode_num, &inode);
+    return end;
 }
 
-bool fs_delete(const char *name) {
-    struct dir_entry entry;
-    uint32_t entry_sector, entry_offset;
+// Helper: Mark blocks [first, first + count) used or free, keeping free_data_blocks exact
+static bool bmap_set(uint32_t first, uint32_t count, bool used) {
+    for (uint32_t b = first; b < first + count; b++) {
+        if (!bmap_load(b / FS_BITS_PER_SECTOR)) return FALSE;
 
-    if (!find_entry(name, &entry, &entry_sector, &entry_offset)) {
-        return FALSE;
-    }
+        uint32_t *word = &fs.bmap_buf[(b % FS_BITS_PER_SECTOR) / 32];
+        uint32_t bit = 1u << (b % 32);
+        if (((*word & bit) != 0) == used) continue;
 
-    // For directories, check if empty
-    if (entry.type == INODE_TYPE_DIR) {
-        // Check for children
-        for (uint32_t s = 0; s < FS_DIRENTRY_SECTORS; s++) {
-            uint32_t sector = FS_DIRENTRY_START + s;
-            if (!read_sector(sector, fs.sector_buf)) continue;
-
-            for (uint32_t i = 0; i < 8; i++) {
-                struct dir_entry *e = (struct dir_entry*)(fs.sector_buf + i * sizeof(struct dir_entry));
-                if (e->inode != 0 && e->parent_inode == entry.inode) {
-                    return FALSE;  // Directory not empty
-                }
-            }
+        if (used) {
+            *word |= bit;
+            fs.sb.free_data_blocks--;
+        } else {
+            *word &= ~bit;
+            fs.sb.free_data_blocks++;
         }
+        fs.bmap_dirty = TRUE;
     }
+    return TRUE;
+}
 
-    // Clear inode
+// Helper: Where a run from block 'b' stops being worth measuring: 'want'
+// blocks on, or the end of the bitmap
+static uint32_t run_end(uint32_t b, uint32_t want) {
+    return want < fs.sb.data_blocks - b ? b + want : fs.sb.data_blocks;
+}
+
+// Helper: Allocate up to 'want' contiguous clusters; returns the count (0 if full).
+// The run starting at 'goal' (an LBA, 0 for none) is taken when it is free, so
+// a growing file stays in one extent. Otherwise runs are tried next-fit from
+// the cursor: the first that holds 'want' wins, and after FS_ALLOC_SCAN_RUNS
+// the largest seen is taken, so the cost does not grow with the volume.
+static uint32_t alloc_run(uint32_t want, uint32_t goal, uint32_t *lba) {
+    uint32_t end = fs.sb.data_blocks;
+    uint32_t best = end, best_len = 0;
+
+    if (fs.sb.free_data_blocks == 0 || want == 0) return 0;
+
+    if (goal >= fs.sb.data_start) {
+        uint32_t g = (goal - fs.sb.data_start) / fs.sb.cluster_sectors;
+        if (g < end && bmap_find(g, g + 1, FALSE) == g) {
+            best = g;
+            best_len = bmap_find(g, run_end(g, want), TRUE) - g;
+        }
+    }
+
+    if (best_len == 0) {
+        uint32_t cursor = (fs.sb.next_free_block - fs.sb.data_start) / fs.sb.cluster_sectors;
+        if (fs.sb.next_free_block < fs.sb.data_start || cursor >= end) cursor = 0;
+
+        uint32_t b = bmap_find(cursor, end, FALSE);
+        for (uint32_t runs = 0; runs < FS_ALLOC_SCAN_RUNS; runs++) {
+            // Wrap around to the start once
+            if (b == end && cursor > 0) {
+                b = bmap_find(0, end, FALSE);
+                cursor = 0;
+            }
+            if (b == end) break;
+
+            uint32_t len = bmap_find(b, run_end(b, want), TRUE) - b;
+            if (len > best_len) {
+                best = b;
+                best_len = len;
+                if (len >= want) break;
+            }
+            b = bmap_find(b + len, end, FALSE);
+        }
+        if (best_len == 0) return 0;
+    }
+    if (best_len > want) best_len = want;
+
+    if (!bmap_set(best, best_len, TRUE)) return 0;
+
+    fs.sb.next_free_block = fs.sb.data_start + (best + best_len) * fs.sb.cluster_sectors;
+    *lba = fs.sb.data_start + best * fs.sb.cluster_sectors;
+    return best_len;
+}
+
+// Helper: Return 'count' clusters starting at 'lba' to the free pool
+static bool free_run(uint32_t lba, uint32_t count) {
+    uint32_t first = (lba - fs.sb.data_start) / fs.sb.cluster_sectors;
+    if (lba < fs.sb.data_start || first + count > fs.sb.data_blocks) {
+        return FALSE;
+    }
+
+    // Cached contents of freed clusters must never be written back
+    bcache_invalidate_range(0, lba, count * fs.sb.cluster_sectors);
+    return bmap_set(first, count, FALSE);
+}
+
+// Helper: Store extent 'idx', allocating the indirect sector on first spill
+static bool set_extent(struct inode *inode, uint32_t idx, const struct fs_extent *ext) {
+    if (idx < FS_INODE_EXTENTS) {
+        inode->extents[idx] = *ext;
+        return TRUE;
+    }
+    if (idx >= FS_MAX_EXTENTS) return FALSE;
+
+    if (inode->indirect == 0) {
+        uint32_t lba;
+        if (alloc_run(1, 0, &lba) == 0) return FALSE;
+        inode->indirect = lba;
+        mem_set(fs.ext_buf, 0, FS_SECTOR_SIZE);
+        fs.ext_sector = lba;
+    } else if (fs.ext_sector != inode->indirect) {
+        struct fs_extent unused;
+        if (!get_extent(inode, FS_INODE_EXTENTS, &unused)) return FALSE;
+    }
+
+    fs.ext_buf[idx - FS_INODE_EXTENTS] = *ext;
+    return write_sector(inode->indirect, fs.ext_buf);
+}
+
+// Helper: Add 'count' clusters at 'lba' to the end of a file, growing the
+// last extent when the run continues it
+static bool append_run(struct inode *inode, uint32_t lba, uint32_t count) {
+    struct fs_extent ext;
+
+    if (inode->extent_count > 0) {
+        if (!get_extent(inode, inode->extent_count - 1, &ext)) return FALSE;
+        if (ext.start + ext.length * fs.sb.cluster_sectors == lba) {
+            ext.length += count;
+            if (!set_extent(inode, inode->extent_count - 1, &ext)) return FALSE;
+            inode->block_count += count;
+            return TRUE;
+        }
+    }
+
+    ext.start = lba;
+    ext.length = count;
+    if (!set_extent(inode, inode->extent_count, &ext)) return FALSE;
+    inode->extent_count++;
+    inode->block_count += count;
+    return TRUE;
+}
+
+// Helper: Free an inode's clusters from cluster 'keep' onwards
+static bool release_blocks(struct inode *inode, uint32_t keep) {
+    uint32_t base = 0;
+    uint32_t kept = 0;      // Extents still in use
+    struct fs_extent ext;
+
+    for (uint32_t i = 0; i < inode->extent_count; i++) {
+        if (!get_extent(inode, i, &ext)) return FALSE;
+
+        uint32_t length = ext.length;
+        if (base + length <= keep) {
+            kept = i + 1;
+        } else {
+            uint32_t head = keep > base ? keep - base : 0;
+            if (!free_run(ext.start + head * fs.sb.cluster_sectors, length - head)) return FALSE;
+
+            if (head > 0) {
+                ext.length = head;
+                if (!set_extent(inode, i, &ext)) return FALSE;
+                kept = i + 1;
+            }
+        }
+        base += length;
+    }
+
+    inode->extent_count = kept;
+    if (inode->block_count > keep) inode->block_count = keep;
+
+    if (kept <= FS_INODE_EXTENTS && inode->indirect != 0) {
+        if (!journal_revoke(inode->indirect) || !free_run(inode->indirect, 1)) return FALSE;
+        if (fs.ext_sector == inode->indirect) fs.ext_sector = 0;
+        inode->indirect = 0;
+    }
+
+    // With no clusters left a compressed file has no chunks to map either
+    if (keep == 0 && inode->type == INODE_TYPE_FILE &&
+        (inode->flags & INODE_FLAG_COMPRESSED) && inode->chunk_map != 0) {
+        if (!journal_revoke(inode->chunk_map) || !free_run(inode->chunk_map, 1)) return FALSE;
+        if (fs.cmap_sector == inode->chunk_map) fs.cmap_sector = 0;
+        if (fs.chunk_map == inode->chunk_map) fs.chunk_map = 0;
+        inode->chunk_map = 0;
+    }
+    return write_super();
+}
+
+// Helper: Free an inode's clusters from cluster 'keep' onwards, last extent
+// first, in pieces of one step each: at most a bitmap sector's worth of
+// clusters or, for a directory table whose sectors are revoked as they go,
+// a few sectors. The inode is written after each piece with its size cut
+// to what is left, so a crash part way leaves a shorter file rather than
+// one pointing at free clusters; a table's size must stay a power of two,
+// so it is cut to its final size at once. With inode_num FS_INODE_NONE
+// the clusters belong to no inode and nothing is written.
+static bool shrink_blocks(uint32_t inode_num, struct inode *inode, uint32_t keep) {
+    bool table = inode->type == INODE_TYPE_DIR;
+    uint32_t cluster_bytes = fs.sb.cluster_sectors * FS_SECTOR_SIZE;
+    uint32_t piece = FS_BITS_PER_SECTOR;
+
+    if (table) {
+        piece = FS_JOURNAL_TXN_REVOKES / 2 / fs.sb.cluster_sectors;
+        if (piece == 0) piece = 1;
+    }
+
+    do {
+        uint32_t from = keep;
+        if (inode->block_count > keep) {
+            struct fs_extent last;
+            if (!get_extent(inode, inode->extent_count - 1, &last)) return FALSE;
+            if (inode->block_count - last.length > from) from = inode->block_count - last.length;
+            if (inode->block_count - from > piece) from = inode->block_count - piece;
+        }
+
+        uint32_t sectors = inode->block_count > from ? (inode->block_count - from) * fs.sb.cluster_sectors : 0;
+        if (!journal_reserve(FS_JOURNAL_STEP_SECTORS, (table ? sectors : 0) + 2)) return FALSE;
+
+        // Table sectors were logged as metadata and may come back as data
+        for (uint32_t i = 0; table && i < sectors; ) {
+            uint32_t lba;
+            uint32_t run = map_block(inode, from * fs.sb.cluster_sectors + i,
+                                     from * fs.sb.cluster_sectors + sectors, &lba);
+            if (run == 0) return FALSE;
+
+            for (uint32_t k = 0; k < run; k++) {
+                if (!journal_revoke(lba + k)) return FALSE;
+            }
+            bcache_invalidate_range(0, lba, run);
+            i += run;
+        }
+
+        if (!release_blocks(inode, from)) return FALSE;
+        if (table) from = keep;
+        if (inode->size > from * cluster_bytes) inode->size = from * cluster_bytes;
+        if (inode_num != FS_INODE_NONE && !write_inode(inode_num, inode)) return FALSE;
+    } while (inode->block_count > keep);
+    return TRUE;
+}
+
+// Helper: Check whether a file's data is kept in compressed chunks
+static bool is_compressed(const struct inode *inode) {
+    return inode->type == INODE_TYPE_FILE &&
+           (inode->flags & (INODE_FLAG_COMPRESSED | INODE_FLAG_INLINE)) == INODE_FLAG_COMPRESSED;
+}
+
+// Helper: Load a compressed file's chunk map into cmap_buf
+static bool cmap_load(const struct inode *inode) {
+    if (inode->chunk_map == 0) return FALSE;
+    if (fs.cmap_sector == inode->chunk_map) return TRUE;
+
+    if (!read_sector(inode->chunk_map, fs.cmap_buf)) {
+        fs.cmap_sector = 0;
+        return FALSE;
+    }
+    fs.cmap_sector = inode->chunk_map;
+    return TRUE;
+}
+
+// Helper: Decompress chunk 'k' of a file into chunk_buf. A compressed slot
+// starts with the 2-byte length of the data after it.
+static bool chunk_get(const struct inode *inode, uint32_t k) {
+    if (fs.chunk_map == inode->chunk_map && fs.chunk_index == k && fs.chunk_map != 0) {
+        return TRUE;
+    }
+    if (k >= FS_MAX_CHUNKS || !cmap_load(inode)) return FALSE;
+
+    uint32_t stored = fs.cmap_buf[k];
+    fs.chunk_map = 0;
+
+    if (stored == 0) {
+        mem_set(fs.chunk_buf, 0, FS_CHUNK_SIZE);
+    } else if (stored >= FS_CHUNK_SECTORS) {
+        if (!read_blocks(inode, k * FS_CHUNK_SECTORS, FS_CHUNK_SECTORS, fs.chunk_buf)) return FALSE;
+    } else {
+        if (!read_blocks(inode, k * FS_CHUNK_SECTORS, stored, fs.zbuf)) return FALSE;
+
+        uint32_t len = fs.zbuf[0] | (fs.zbuf[1] << 8);
+        if (len > stored * FS_SECTOR_SIZE - 2 ||
+            lz_decompress(fs.zbuf + 2, len, fs.chunk_buf, FS_CHUNK_SIZE) != FS_CHUNK_SIZE) {
+            return FALSE;
+        }
+    }
+
+    fs.chunk_map = inode->chunk_map;
+    fs.chunk_index = k;
+    return TRUE;
+}
+
+// Helper: Store chunk_buf as chunk 'k' of a file: not at all if it is all
+// zeros, compressed if that saves a sector, as is otherwise
+static bool chunk_store(const struct inode *inode, uint32_t k) {
+    uint32_t stored = 0;
+
+    if (k >= FS_MAX_CHUNKS || !cmap_load(inode)) return FALSE;
+    fs.chunk_map = 0;
+
+    for (uint32_t i = 0; i < FS_CHUNK_SIZE; i++) {
+        if (fs.chunk_buf[i] != 0) {
+            stored = FS_CHUNK_SECTORS;
+            break;
+        }
+    }
+
+    if (stored != 0) {
+        uint32_t cap = (FS_CHUNK_SECTORS - 1) * FS_SECTOR_SIZE - 2;
+        uint32_t len = lz_compress(fs.chunk_buf, FS_CHUNK_SIZE, fs.zbuf + 2, cap);
+
+        if (len != 0) {
+            fs.zbuf[0] = len & 0xFF;
+            fs.zbuf[1] = len >> 8;
+            stored = (len + 2 + FS_SECTOR_SIZE - 1) / FS_SECTOR_SIZE;
+            mem_set(fs.zbuf + 2 + len, 0, stored * FS_SECTOR_SIZE - 2 - len);
+            if (!write_blocks(inode, k * FS_CHUNK_SECTORS, stored, fs.zbuf)) return FALSE;
+        } else if (!write_blocks(inode, k * FS_CHUNK_SECTORS, FS_CHUNK_SECTORS, fs.chunk_buf)) {
+            return FALSE;
+        }
+    }
+
+    if (fs.cmap_buf[k] != stored) {
+        fs.cmap_buf[k] = stored;
+        if (!journal_reserve(2, 0) || !write_sector(inode->chunk_map, fs.cmap_buf)) return FALSE;
+    }
+
+    fs.chunk_map = inode->chunk_map;
+    fs.chunk_index = k;
+    return TRUE;
+}
+
+// Helper: Read bytes [off, off + len) of a compressed file into dst
+static bool read_chunks(const struct inode *inode, uint8_t *dst, uint32_t off, uint32_t len) {
+    while (len > 0) {
+        uint32_t within = off % FS_CHUNK_SIZE;
+        uint32_t n = FS_CHUNK_SIZE - within;
+        if (n > len) n = len;
+
+        if (!chunk_get(inode, off / FS_CHUNK_SIZE)) return FALSE;
+        mem_cpy(dst, fs.chunk_buf + within, n);
+
+        off += n;
+        dst += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+// Helper: write_range for a compressed file. Each chunk touched is
+// rebuilt in chunk_buf and stored again whole.
+static bool write_chunks(const struct inode *inode, const uint8_t *src,
+                         uint32_t off, uint32_t len, uint32_t valid) {
+    while (len > 0) {
+        uint32_t k = off / FS_CHUNK_SIZE;
+        uint32_t base = k * FS_CHUNK_SIZE;
+        uint32_t within = off - base;
+        uint32_t n = FS_CHUNK_SIZE - within;
+        if (n > len) n = len;
+
+        // Only a partly overwritten chunk needs its old contents
+        if (n < FS_CHUNK_SIZE && base < valid) {
+            if (!chunk_get(inode, k)) return FALSE;
+            if (valid < base + FS_CHUNK_SIZE) {
+                mem_set(fs.chunk_buf + (valid - base), 0, base + FS_CHUNK_SIZE - valid);
+            }
+        } else if (n < FS_CHUNK_SIZE) {
+            mem_set(fs.chunk_buf, 0, FS_CHUNK_SIZE);
+        }
+
+        if (src != NULL) {
+            mem_cpy(fs.chunk_buf + within, src, n);
+        } else {
+            mem_set(fs.chunk_buf + within, 0, n);
+        }
+        if (!chunk_store(inode, k)) return FALSE;
+
+        off += n;
+        len -= n;
+        if (src != NULL) src += n;
+    }
+    return TRUE;
+}
+
+// Helper: Turn a compressed file back into a plain one in place. Each chunk
+// is written out whole in its own slot and marked stored as is, so the file
+// reads the same at every step.
+static bool expand_chunks(uint32_t inode_num, struct inode *inode) {
+    uint32_t chunks = (inode->size + FS_CHUNK_SIZE - 1) / FS_CHUNK_SIZE;
+
+    if (inode->chunk_map != 0) {
+        for (uint32_t k = 0; k < chunks; k++) {
+            if (!cmap_load(inode)) return FALSE;
+            if (fs.cmap_buf[k] == FS_CHUNK_SECTORS) continue;
+
+            if (!chunk_get(inode, k) ||
+                !write_blocks(inode, k * FS_CHUNK_SECTORS, FS_CHUNK_SECTORS, fs.chunk_buf)) {
+                return FALSE;
+            }
+            fs.cmap_buf[k] = FS_CHUNK_SECTORS;
+            if (!journal_reserve(2, 0) || !write_sector(inode->chunk_map, fs.cmap_buf)) return FALSE;
+        }
+    }
+
+    // The map goes in the same step as the inode that stops using it
+    if (!journal_reserve(FS_JOURNAL_STEP_SECTORS, 1)) return FALSE;
+    if (inode->chunk_map != 0) {
+        if (!journal_revoke(inode->chunk_map) || !free_run(inode->chunk_map, 1)) return FALSE;
+        if (fs.cmap_sector == inode->chunk_map) fs.cmap_sector = 0;
+        if (fs.chunk_map == inode->chunk_map) fs.chunk_map = 0;
+    }
+
+    inode->chunk_map = 0;
+    inode->flags &= ~INODE_FLAG_COMPRESSED;
+    return write_inode(inode_num, inode) && write_super();
+}
+
+// Helper: Grow or shrink a file's clusters to hold 'size' bytes, in steps
+// that each record their clusters in the inode, so nothing leaks when
+// allocation fails part way.
+static bool resize_clusters(uint32_t inode_num, struct inode *inode, uint32_t size) {
+    uint32_t cluster_bytes = fs.sb.cluster_sectors * FS_SECTOR_SIZE;
+    uint32_t chunks = 0;
+
+    // A compressed file holds whole chunk slots; past the chunk map's reach
+    // it goes back to plain storage. Chunks it no longer needs are dropped
+    // from the map so they read back as zeros if the file grows again.
+    if (is_compressed(inode) && size > FS_COMPRESS_MAX_SIZE && !expand_chunks(inode_num, inode)) {
+        return FALSE;
+    }
+    if (is_compressed(inode)) {
+        chunks = (size + FS_CHUNK_SIZE - 1) / FS_CHUNK_SIZE;
+        size = chunks * FS_CHUNK_SIZE;
+
+        if (inode->chunk_map != 0) {
+            if (!cmap_load(inode)) return FALSE;
+
+            bool trimmed = FALSE;
+            for (uint32_t k = chunks; k < FS_MAX_CHUNKS; k++) {
+                if (fs.cmap_buf[k] != 0) {
+                    fs.cmap_buf[k] = 0;
+                    trimmed = TRUE;
+                }
+            }
+            if (trimmed && (!journal_reserve(2, 0) || !write_sector(inode->chunk_map, fs.cmap_buf))) {
+                return FALSE;
+            }
+            if (fs.chunk_map == inode->chunk_map && fs.chunk_index >= chunks) fs.chunk_map = 0;
+        }
+    }
+
+    uint32_t clusters_needed = size / cluster_bytes + (size % cluster_bytes != 0 ? 1 : 0);
+
+    // Give back clusters the file no longer needs
+    if (inode->block_count > clusters_needed && !shrink_blocks(inode_num, inode, clusters_needed)) {
+        return FALSE;
+    }
+
+    // Allocate new clusters if needed, as few contiguous runs as possible,
+    // starting right after the file's last extent. Each run is a step of
+    // its own, capped so it changes no more than two bitmap sectors.
+    while (inode->block_count < clusters_needed) {
+        if (!journal_reserve(FS_JOURNAL_STEP_SECTORS, 0)) return FALSE;
+
+        struct fs_extent last;
+        uint32_t goal = 0;
+        if (inode->extent_count > 0) {
+            if (!get_extent(inode, inode->extent_count - 1, &last)) return FALSE;
+            goal = last.start + last.length * fs.sb.cluster_sectors;
+        }
+
+        uint32_t want = clusters_needed - inode->block_count;
+        if (want > FS_BITS_PER_SECTOR) want = FS_BITS_PER_SECTOR;
+
+        uint32_t lba;
+        uint32_t len = alloc_run(want, goal, &lba);
+        if (len == 0) {
+            return FALSE;                       // Disk full
+        }
+        if (!append_run(inode, lba, len)) {
+            free_run(lba, len);                 // Too fragmented for the extent list
+            return FALSE;
+        }
+        if (!write_inode(inode_num, inode)) return FALSE;
+    }
+
+    // A zeroed map: every chunk starts out reading as zeros
+    if (chunks > 0 && inode->chunk_map == 0) {
+        uint32_t lba;
+        if (!journal_reserve(FS_JOURNAL_STEP_SECTORS, 0) || alloc_run(1, 0, &lba) == 0) {
+            return FALSE;
+        }
+        mem_set(fs.cmap_buf, 0, FS_SECTOR_SIZE);
+        fs.cmap_sector = lba;
+        inode->chunk_map = lba;
+        if (!write_sector(lba, fs.cmap_buf) || !write_inode(inode_num, inode)) return FALSE;
+    }
+
+    // Record the inode even when no step did
+    return journal_reserve(2, 0) && write_inode(inode_num, inode);
+}
+
+// Helper: Length of the physically contiguous run in a v1/v2 block list
+static uint32_t legacy_run(const struct inode_v2 *inode, uint32_t first, uint32_t end) {
+    uint32_t len = 1;
+    while (first + len < end &&
+           inode->blocks[first + len] == inode->blocks[first] + len) {
+        len++;
+    }
+    return len;
+}
+
+// Helper: Upgrade a v1 volume in place. v1 data starts right after the
+// entry table, so the bitmap goes at the tail of the volume; it is filled
+// from the blocks live inodes reference, which also reclaims what v1 leaked.
+static bool migrate_v1(void) {
+    uint32_t span = fs.sb.total_sectors - fs.sb.data_start;
+    uint32_t bitmap_sectors = (span + FS_BITS_PER_SECTOR - 1) / FS_BITS_PER_SECTOR;
+
+    if (fs.sb.next_free_block > fs.sb.total_sectors - bitmap_sectors) {
+        vga_puts("[!] Cannot upgrade filesystem: no room for the block bitmap\n");
+        return FALSE;
+    }
+
+    fs.sb.bitmap_sectors = bitmap_sectors;
+    fs.sb.bitmap_start = fs.sb.total_sectors - bitmap_sectors;
+    fs.sb.data_blocks = span - bitmap_sectors;
+    fs.sb.free_data_blocks = fs.sb.data_blocks;
+
+    mem_set(fs.bmap_buf, 0, FS_SECTOR_SIZE);
+    for (uint32_t s = 0; s < bitmap_sectors; s++) {
+        if (!write_sector(fs.sb.bitmap_start + s, fs.bmap_buf)) return FALSE;
+    }
+    fs.bmap_sector = -1;
+    fs.bmap_dirty = FALSE;
+
+    for (uint32_t n = 0; n < fs.sb.inode_count; n++) {
+        struct inode raw;
+        struct inode_v2 old;
+        if (!read_inode(n, &raw)) return FALSE;
+        mem_cpy(&old, &raw, sizeof(struct inode_v2));
+        if (old.type != INODE_TYPE_FILE) continue;
+
+        for (uint32_t i = 0; i < old.block_count; ) {
+            uint32_t run = legacy_run(&old, i, old.block_count);
+            uint32_t first = old.blocks[i] - fs.sb.data_start;
+
+            if (old.blocks[i] >= fs.sb.data_start && first + run <= fs.sb.data_blocks &&
+                !bmap_set(first, run, TRUE)) {
+                return FALSE;
+            }
+            i += run;
+        }
+    }
+
+    fs.sb.version = 2;
+    if (!write_super()) return FALSE;
+
+    vga_puts("[*] Filesystem upgraded to version 2\n");
+    return fs_sync();
+}
+
+// Helper: Upgrade a v2 volume in place by turning each file's block list
+// into extents. More than four runs spill into an indirect sector.
+static bool migrate_v2(void) {
+    for (uint32_t n = 0; n < fs.sb.inode_count; n++) {
+        struct inode raw;
+        struct inode_v2 old;
+        if (!read_inode(n, &raw)) return FALSE;
+        mem_cpy(&old, &raw, sizeof(struct inode_v2));
+        if (old.type == INODE_TYPE_FREE) continue;
+
+        struct inode inode;
+        mem_set(&inode, 0, sizeof(struct inode));
+        inode.type = old.type;
+        inode.permissions = old.permissions;
+        inode.size = old.size;
+        inode.parent_inode = old.parent_inode;
+        inode.created = old.created;
+
+        uint32_t count = old.type == INODE_TYPE_FILE ? old.block_count : 0;
+        if (count > FS_DIRECT_BLOCKS) count = FS_DIRECT_BLOCKS;
+
+        for (uint32_t i = 0; i < count; ) {
+            uint32_t run = legacy_run(&old, i, count);
+            if (!append_run(&inode, old.blocks[i], run)) return FALSE;
+            i += run;
+        }
+
+        if (!write_inode(n, &inode)) return FALSE;
+    }
+
+    fs.sb.version = 3;
+    if (!write_super()) return FALSE;
+
+    vga_puts("[*] Filesystem upgraded to version 3\n");
+    return fs_sync();
+}
+
+// Helper: Carve the journal out of free clusters and write its first sector.
+// A volume with no contiguous room for it simply runs without a journal.
+static bool journal_create(void) {
+    uint32_t clusters = (FS_JOURNAL_SECTORS + fs.sb.cluster_sectors - 1) / fs.sb.cluster_sectors;
+    uint32_t lba;
+    uint32_t got = alloc_run(clusters, 0, &lba);
+
+    fs.sb.journal_start = 0;
+    fs.sb.journal_sectors = 0;
+    if (got < clusters) {
+        if (got > 0) free_run(lba, got);
+        vga_puts("[!] No room for a journal; metadata is written in place\n");
+        return write_super();
+    }
+
+    fs.sb.journal_start = lba;
+    fs.sb.journal_sectors = clusters * fs.sb.cluster_sectors;
+    fs.journal_seq = 1;
+    fs.journal_head = 0;
+    fs.journal_revokes = 0;
+
+    struct journal_super *js = (struct journal_super*)journal_buf;
+    mem_set(js, 0, FS_SECTOR_SIZE);
+    js->magic = FS_JOURNAL_MAGIC;
+    js->sequence = fs.journal_seq;
+    if (!write_sectors(lba, 1, js)) return FALSE;
+
+    return write_super();
+}
+
+// Helper: Upgrade a v3 volume; it was laid out in one-sector clusters
+static bool migrate_v3(void) {
+    fs.sb.cluster_sectors = 1;
+    fs.sb.version = 4;
+    if (!write_super()) return FALSE;
+
+    vga_puts("[*] Filesystem upgraded to version 4\n");
+    return fs_sync();
+}
+
+// Helper: Upgrade a v4 volume by adding a metadata journal
+static bool migrate_v4(void) {
+    if (!journal_create()) return FALSE;
+
+    fs.sb.version = 5;
+    if (!write_super()) return FALSE;
+
+    vga_puts("[*] Filesystem upgraded to version 5\n");
+    return fs_sync();
+}
+
+// Helper: Upgrade a version 5 volume to version 6. Inline data only uses
+// the inode flags byte, which earlier versions always left zero.
+static bool migrate_v5(void) {
+    fs.sb.version = 6;
+    if (!write_super()) return FALSE;
+
+    vga_puts("[*] Filesystem upgraded to version 6\n");
+    return fs_sync();
+}
+
+// Helper: Upgrade a version 8 volume to version 9. No file is compressed
+// until asked, and the flag bit was always zero before.
+static bool migrate_v8(void) {
+    fs.sb.version = 9;
+    if (!write_super()) return FALSE;
+
+    vga_puts("[*] Filesystem upgraded to version 9\n");
+    return fs_sync();
+}
+
+// Helper: Upgrade a version 9 volume to version 10 by giving it a checksum
+// table, carved out of free clusters. Sectors written before have no entry
+// and go unchecked until they are next written.
+static bool migrate_v9(void) {
+    uint32_t sectors = (fs.sb.total_sectors + FS_CSUMS_PER_SECTOR - 1) / FS_CSUMS_PER_SECTOR;
+    uint32_t clusters = (sectors + fs.sb.cluster_sectors - 1) / fs.sb.cluster_sectors;
+    uint32_t lba;
+    uint32_t got = alloc_run(clusters, 0, &lba);
+
+    if (got < clusters) {
+        if (got > 0) free_run(lba, got);
+        vga_puts("[!] No room for a checksum table; sectors are not verified\n");
+    } else {
+        if (!zero_sectors(lba, sectors)) return FALSE;
+        fs.sb.csum_start = lba;
+        fs.sb.csum_sectors = sectors;
+        fs.csum_active = TRUE;
+        fs.csum_sector = -1;
+    }
+
+    fs.sb.version = 10;
+    if (!write_super()) return FALSE;
+
+    vga_puts("[*] Filesystem upgraded to version 10\n");
+    return fs_sync();
+}
+
+// Helper: FNV-1a hash of an entry name
+static uint32_t name_hash(const char *name) {
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (uint8_t)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Helper: Load the sector holding entry 'index' of a directory into
+// fs.sector_buf. Returns its LBA, 0 on failure.
+static uint32_t dir_sector(const struct inode *dir, uint32_t index) {
+    uint32_t block = index / FS_DIRENTS_PER_SECTOR;
+    uint32_t lba;
+
+    if (map_block(dir, block, block + 1, &lba) == 0 || !read_sector(lba, fs.sector_buf)) {
+        return 0;
+    }
+    return lba;
+}
+
+// Helper: Sectors a directory's table needs for 'count' entries: a power
+// of two, at least a cluster, with no more than half its slots in use
+static uint32_t dir_table_size(uint32_t count) {
+    uint32_t sectors = fs.sb.cluster_sectors;
+    while (sectors * FS_DIRENTS_PER_SECTOR < count * 2) sectors *= 2;
+    return sectors;
+}
+
+// Helper: Scan a directory for the entry of inode 'target'. Sectors come
+// through the block cache with readahead, so a long scan costs a few large
+// reads. The entry is copied to 'out' and *index set to it, or to
+// FS_DIR_NONE if there is none.
+static bool dir_scan(uint32_t dir_num, uint32_t target, struct dir_entry *out, uint32_t *index) {
+    struct inode dir;
+    if (!read_inode(dir_num, &dir)) return FALSE;
+
+    uint32_t count = dir.size / sizeof(struct dir_entry);
+    uint32_t sectors = (dir.size + FS_SECTOR_SIZE - 1) / FS_SECTOR_SIZE;
+    struct fs_readahead *ra = ra_get(dir_num);
+
+    *index = FS_DIR_NONE;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t slot = i % FS_DIRENTS_PER_SECTOR;
+        if (slot == 0) {
+            if (dir_sector(&dir, i) == 0) return FALSE;
+            readahead(ra, &dir, i / FS_DIRENTS_PER_SECTOR, 1, sectors);
+        }
+
+        struct dir_entry *e = (struct dir_entry*)(fs.sector_buf + slot * sizeof(struct dir_entry));
+        if (e->inode == 0) continue;
+
+        if (e->inode == target) {
+            mem_cpy(out, e, sizeof(struct dir_entry));
+            *index = i;
+            return TRUE;
+        }
+    }
+    return TRUE;
+}
+
+// Helper: Look a name up in a directory, starting at the sector it hashes
+// to. A sector with a never-used slot ends the search, since no entry was
+// ever pushed on past it, so this is usually the only sector read. The
+// entry is copied to 'out' and *index set to it, or to FS_DIR_NONE.
+static bool dir_find(uint32_t dir_num, const char *name, struct dir_entry *out, uint32_t *index) {
+    struct inode dir;
+    if (!read_inode(dir_num, &dir)) return FALSE;
+
+    uint32_t sectors = dir.size / FS_SECTOR_SIZE;
+    uint32_t home = name_hash(name);
+
+    *index = FS_DIR_NONE;
+    for (uint32_t k = 0; k < sectors; k++) {
+        uint32_t first = ((home + k) & (sectors - 1)) * FS_DIRENTS_PER_SECTOR;
+        if (dir_sector(&dir, first) == 0) return FALSE;
+
+        bool open = FALSE;
+        for (uint32_t i = 0; i < FS_DIRENTS_PER_SECTOR; i++) {
+            struct dir_entry *e = (struct dir_entry*)(fs.sector_buf + i * sizeof(struct dir_entry));
+            if (e->inode != 0 && str_cmp(e->name, name) == 0) {
+                mem_cpy(out, e, sizeof(struct dir_entry));
+                *index = first + i;
+                return TRUE;
+            }
+            if (e->inode == 0 && e->type != FS_DIR_REMOVED) open = TRUE;
+        }
+        if (open) break;
+    }
+    return TRUE;
+}
+
+// Helper: Store an entry in the first free slot from the sector its name
+// hashes to on, and set *index to it. This logs one table sector.
+static bool dir_place(const struct inode *dir, const struct dir_entry *entry, uint32_t *index) {
+    uint32_t sectors = dir->size / FS_SECTOR_SIZE;
+    uint32_t home = name_hash(entry->name);
+
+    for (uint32_t k = 0; k < sectors; k++) {
+        uint32_t first = ((home + k) & (sectors - 1)) * FS_DIRENTS_PER_SECTOR;
+        uint32_t lba = dir_sector(dir, first);
+        if (lba == 0) return FALSE;
+
+        for (uint32_t i = 0; i < FS_DIRENTS_PER_SECTOR; i++) {
+            struct dir_entry *e = (struct dir_entry*)(fs.sector_buf + i * sizeof(struct dir_entry));
+            if (e->inode == 0) {
+                mem_cpy(e, entry, sizeof(struct dir_entry));
+                *index = first + i;
+                return write_sector(lba, fs.sector_buf);
+            }
+        }
+    }
+    return FALSE;       // Full, which the size rules never allow
+}
+
+// Helper: Move a directory's entries into a new table of 'sectors' sectors,
+// leaving removed slots behind. The table is filled in fresh clusters and
+// only replaces the old one with the inode write, so a failure or a crash
+// before that leaves the directory as it was; a crash can at worst leak
+// the clusters of whichever table is not in use. Entry indexes change, so
+// cached lookups in the directory are dropped.
+static bool dir_rebuild(uint32_t dir_num, struct inode *dir, uint32_t sectors) {
+    struct inode table = *dir;
+    uint32_t clusters = sectors / fs.sb.cluster_sectors;
+
+    table.extent_count = 0;
+    table.indirect = 0;
+    table.block_count = 0;
+    table.size = sectors * FS_SECTOR_SIZE;
+
+    bool ok = TRUE;
+    while (ok && table.block_count < clusters) {
+        uint32_t want = clusters - table.block_count;
+        if (want > FS_BITS_PER_SECTOR) want = FS_BITS_PER_SECTOR;
+
+        uint32_t lba;
+        uint32_t len = journal_reserve(FS_JOURNAL_STEP_SECTORS, 0) ? alloc_run(want, 0, &lba) : 0;
+        if (len == 0) {
+            ok = FALSE;                         // Disk full
+        } else if (!append_run(&table, lba, len)) {
+            free_run(lba, len);                 // Too fragmented for the extent list
+            ok = FALSE;
+        }
+    }
+
+    // Start from never-used slots, then hash every entry into place
+    for (uint32_t s = 0; ok && s < sectors; ) {
+        uint32_t lba;
+        uint32_t run = map_block(&table, s, sectors, &lba);
+        ok = run != 0 && zero_sectors(lba, run);
+        s += run;
+    }
+
+    uint8_t old[FS_SECTOR_SIZE];
+    uint32_t count = dir->size / sizeof(struct dir_entry);
+    for (uint32_t i = 0; ok && i < count; i++) {
+        uint32_t slot = i % FS_DIRENTS_PER_SECTOR;
+        if (slot == 0) {
+            uint32_t block = i / FS_DIRENTS_PER_SECTOR;
+            uint32_t lba;
+            if (map_block(dir, block, block + 1, &lba) == 0 || !read_sector(lba, old)) {
+                ok = FALSE;
+                break;
+            }
+        }
+
+        struct dir_entry *e = (struct dir_entry*)(old + slot * sizeof(struct dir_entry));
+        uint32_t index;
+        if (e->inode != 0) ok = journal_reserve(2, 0) && dir_place(&table, e, &index);
+    }
+
+    if (!ok || !journal_reserve(2, 0)) {
+        shrink_blocks(FS_INODE_NONE, &table, 0);
+        return FALSE;
+    }
+
+    struct inode previous = *dir;
+    *dir = table;
+    if (!write_inode(dir_num, dir)) return FALSE;
+
+    dcache_purge(dir_num);
+    ra_forget(dir_num);
+    return shrink_blocks(FS_INODE_NONE, &previous, 0);
+}
+
+// Helper: Check whether a directory sector is full, with no never-used
+// slot to end a lookup there. Its removed slots are added to *removed.
+static bool dir_full(const struct inode *dir, uint32_t sector, bool *full, uint32_t *removed) {
+    if (dir_sector(dir, sector * FS_DIRENTS_PER_SECTOR) == 0) return FALSE;
+
+    *full = TRUE;
+    for (uint32_t i = 0; i < FS_DIRENTS_PER_SECTOR; i++) {
+        struct dir_entry *e = (struct dir_entry*)(fs.sector_buf + i * sizeof(struct dir_entry));
+        if (e->inode == 0 && e->type == FS_DIR_REMOVED) (*removed)++;
+        else if (e->inode == 0) *full = FALSE;
+    }
+    return TRUE;
+}
+
+// Helper: Check the run of full sectors around 'sector' once an entry went
+// into it. Lookups walk such runs, so one longer than FS_DIR_MAX_RUN has
+// the table rebuilt: at the size it needs if removed slots filled the run,
+// at twice the size if live entries did. *rebuilt tells whether it was.
+static bool dir_check_run(uint32_t dir_num, struct inode *dir, uint32_t sector, bool *rebuilt) {
+    uint32_t sectors = dir->size / FS_SECTOR_SIZE;
+    uint32_t removed = 0;
+    uint32_t run = 1;
+    bool full;
+
+    *rebuilt = FALSE;
+    if (!dir_full(dir, sector, &full, &removed)) return FALSE;
+    if (!full) return TRUE;
+
+    for (uint32_t k = 1; run <= FS_DIR_MAX_RUN && run < sectors; k++) {
+        if (!dir_full(dir, (sector + k) & (sectors - 1), &full, &removed)) return FALSE;
+        if (!full) break;
+        run++;
+    }
+    for (uint32_t k = 1; run <= FS_DIR_MAX_RUN && run < sectors; k++) {
+        if (!dir_full(dir, (sector - k) & (sectors - 1), &full, &removed)) return FALSE;
+        if (!full) break;
+        run++;
+    }
+
+    if (run <= FS_DIR_MAX_RUN) return TRUE;
+    *rebuilt = TRUE;
+    return dir_rebuild(dir_num, dir, removed > 0 ? dir_table_size(dir->child_count) : sectors * 2);
+}
+
+// Helper: Make sure a directory has room for one more entry: the table
+// doubles before it gets more than half full
+static bool dir_make_room(uint32_t dir_num) {
+    struct inode dir;
+    if (!read_inode(dir_num, &dir)) return FALSE;
+
+    uint32_t sectors = dir_table_size(dir.child_count + 1);
+    return dir.size / FS_SECTOR_SIZE >= sectors || dir_rebuild(dir_num, &dir, sectors);
+}
+
+// Helper: Add an entry to a directory that dir_make_room has made room in,
+// as part of the caller's step. The table is rebuilt afterwards when
+// entries pile up in one place.
+static bool dir_add(uint32_t dir_num, const char *name, uint32_t inode_num,
+                    uint8_t type, uint32_t *index) {
+    struct inode dir;
+    if (!read_inode(dir_num, &dir)) return FALSE;
+
+    struct dir_entry e;
+    mem_set(&e, 0, sizeof(struct dir_entry));
+    e.inode = inode_num;
+    e.parent_inode = dir_num;
+    e.type = type;
+    e.name_len = str_len(name);
+    str_ncpy(e.name, name, FS_MAX_FILENAME - 1);
+
+    if (!dir_place(&dir, &e, index)) return FALSE;
+
+    dir.child_count++;
+    if (!write_inode(dir_num, &dir)) return FALSE;
+
+    // A rebuild moves the entry, so look it up again
+    bool rebuilt;
+    if (!dir_check_run(dir_num, &dir, *index / FS_DIRENTS_PER_SECTOR, &rebuilt)) return FALSE;
+    return !rebuilt || dir_find(dir_num, name, &e, index);
+}
+
+// Helper: Clear entry 'index' of a directory. While its sector has no
+// other never-used slot lookups still have to go on past it, so the slot
+// is marked removed; otherwise every removed slot there can be reused
+// as never-used.
+static bool dir_remove(uint32_t dir_num, uint32_t index) {
+    struct inode dir;
+    if (!read_inode(dir_num, &dir)) return FALSE;
+
+    uint32_t lba = dir_sector(&dir, index);
+    if (lba == 0) return FALSE;
+
+    struct dir_entry *entries = (struct dir_entry*)fs.sector_buf;
+    struct dir_entry *e = &entries[index % FS_DIRENTS_PER_SECTOR];
+    mem_set(e, 0, sizeof(struct dir_entry));
+    e->type = FS_DIR_REMOVED;
+
+    bool open = FALSE;
+    for (uint32_t i = 0; i < FS_DIRENTS_PER_SECTOR; i++) {
+        if (entries[i].inode == 0 && entries[i].type != FS_DIR_REMOVED) open = TRUE;
+    }
+    for (uint32_t i = 0; open && i < FS_DIRENTS_PER_SECTOR; i++) {
+        if (entries[i].inode == 0) entries[i].type = INODE_TYPE_FREE;
+    }
+    if (!write_sector(lba, fs.sector_buf)) return FALSE;
+
+    if (dir.child_count > 0) dir.child_count--;
+    return write_inode(dir_num, &dir);
+}
+
+// Helper: Upgrade a version 6 volume to version 7 by moving every entry
+// of the global table into its parent directory's own blocks
+static bool migrate_v6(void) {
+    uint8_t table[FS_SECTOR_SIZE];
+
+    // Directories had no blocks of their own yet
+    for (uint32_t i = 0; i < fs.sb.inode_count; i++) {
+        struct inode inode;
+        if (!read_inode(i, &inode)) return FALSE;
+        if (inode.type == INODE_TYPE_DIR) {
+            inode.size = 0;
+            inode.child_count = 0;
+            if (!write_inode(i, &inode)) return FALSE;
+        }
+    }
+
+    for (uint32_t s = 0; s < FS_DIRENTRY_SECTORS; s++) {
+        if (!read_sector(fs.sb.direntry_start + s, table)) return FALSE;
+
+        for (uint32_t i = 0; i < FS_DIRENTS_PER_SECTOR; i++) {
+            struct dir_entry *e = (struct dir_entry*)(table + i * sizeof(struct dir_entry));
+            uint32_t index;
+            if (e->inode != 0 && (!dir_make_room(e->parent_inode) ||
+                                  !dir_add(e->parent_inode, e->name, e->inode, e->type, &index))) {
+                return FALSE;
+            }
+        }
+    }
+
+    fs.sb.direntry_start = 0;
+    fs.sb.version = 7;
+    if (!write_super()) return FALSE;
+
+    vga_puts("[*] Filesystem upgraded to version 7\n");
+    return fs_sync();
+}
+
+// Helper: Upgrade a version 7 volume to version 8 by giving its fixed
+// 64-inode table a free-inode bitmap, carved out of free clusters
+static bool migrate_v7(void) {
+    uint32_t sectors = (fs.sb.inode_count + FS_BITS_PER_SECTOR - 1) / FS_BITS_PER_SECTOR;
+    uint32_t clusters = (sectors + fs.sb.cluster_sectors - 1) / fs.sb.cluster_sectors;
+    uint32_t lba;
+    uint32_t got = alloc_run(clusters, 0, &lba);
+
+    if (got < clusters) {
+        if (got > 0) free_run(lba, got);
+        vga_puts("[!] Cannot upgrade filesystem: no room for the inode bitmap\n");
+        return FALSE;
+    }
+
+    mem_set(fs.imap_buf, 0, FS_SECTOR_SIZE);
+    for (uint32_t s = 0; s < sectors; s++) {
+        if (!write_sector(lba + s, fs.imap_buf)) return FALSE;
+    }
+    fs.imap_sector = -1;
+    fs.imap_dirty = FALSE;
+
+    fs.sb.inode_bitmap_start = lba;
+    fs.sb.inode_bitmap_sectors = sectors;
+    fs.sb.free_inodes = fs.sb.inode_count;
+
+    for (uint32_t n = 0; n < fs.sb.inode_count; n++) {
+        struct inode inode;
+        if (!read_inode(n, &inode)) return FALSE;
+        if (inode.type != INODE_TYPE_FREE && !imap_set(n, TRUE)) return FALSE;
+    }
+
+    fs.sb.version = 8;
+    if (!write_super()) return FALSE;
+
+    vga_puts("[*] Filesystem upgraded to version 8\n");
+    return fs_sync();
+}
+
+// Helper: Upgrade a version 10 volume to version 11 by rebuilding every
+// directory that has entry blocks as a hash table
+static bool migrate_v10(void) {
+    for (uint32_t n = 0; n < fs.sb.inode_count; n++) {
+        struct inode inode;
+        if (!read_inode(n, &inode)) return FALSE;
+        if (inode.type == INODE_TYPE_DIR && inode.size > 0 &&
+            !dir_rebuild(n, &inode, dir_table_size(inode.child_count))) {
+            return FALSE;
+        }
+    }
+
+    fs.sb.version = 11;
+    if (!write_super()) return FALSE;
+
+    vga_puts("[*] Filesystem upgraded to version 11\n");
+    return fs_sync();
+}
+
+// Helper: Drop every cached lookup
+static void dcache_reset(void) {
+    mem_set(fs.dcache, 0, sizeof(fs.dcache));
+    fs.dcache_clock = 0;
+}
+
+// Helper: Cached lookup of a name in a directory, NULL if not cached
+static struct fs_dentry *dcache_find(uint32_t dir, const char *name, uint32_t h) {
+    for (uint32_t i = 0; i < FS_DCACHE_SIZE; i++) {
+        struct fs_dentry *d = &fs.dcache[i];
+        if (d->used && d->hash == h && d->parent_inode == dir && str_cmp(d->name, name) == 0) {
+            d->last_used = ++fs.dcache_clock;
+            return d;
+        }
+    }
+    return NULL;
+}
+
+// Helper: Record the result of a lookup (inode 0 for a miss), replacing any
+// older result for the same name or else the least recently used entry
+static struct fs_dentry *dcache_add(uint32_t dir, const char *name, uint32_t inode,
+                                    uint8_t type, uint32_t index) {
+    uint32_t h = name_hash(name);
+    struct fs_dentry *d = dcache_find(dir, name, h);
+
+    if (d == NULL) {
+        d = &fs.dcache[0];
+        for (uint32_t i = 1; i < FS_DCACHE_SIZE && d->used; i++) {
+            if (!fs.dcache[i].used || fs.dcache[i].last_used < d->last_used) {
+                d = &fs.dcache[i];
+            }
+        }
+        d->used = TRUE;
+        d->parent_inode = dir;
+        d->hash = h;
+        str_ncpy(d->name, name, FS_MAX_FILENAME - 1);
+        d->name[FS_MAX_FILENAME - 1] = '\0';
+    }
+
+    d->inode = inode;
+    d->type = type;
+    d->index = index;
+    d->last_used = ++fs.dcache_clock;
+    return d;
+}
+
+// Helper: Forget lookups in a directory that is going away
+static void dcache_purge(uint32_t dir) {
+    for (uint32_t i = 0; i < FS_DCACHE_SIZE; i++) {
+        if (fs.dcache[i].parent_inode == dir) fs.dcache[i].used = FALSE;
+    }
+}
+
+// Helper: Look a name up in a directory, through the dentry cache first and
+// then the directory's own entries. The result (hit or miss) is cached.
+// Returns NULL only if the directory could not be read; the entry stays
+// valid until the next lookup.
+static struct fs_dentry *lookup(uint32_t dir, const char *name) {
+    struct fs_dentry *d = dcache_find(dir, name, name_hash(name));
+    if (d != NULL) return d;
+
+    struct dir_entry e;
+    uint32_t index;
+    if (!dir_find(dir, name, &e, &index)) return NULL;
+
+    if (index == FS_DIR_NONE) {
+        return dcache_add(dir, name, 0, INODE_TYPE_FREE, FS_DIR_NONE);
+    }
+    return dcache_add(dir, name, e.inode, e.type, index);
+}
+
+// Helper: Find directory entry by name in a directory. The entry is built
+// from the lookup, so a cached name costs no disk I/O.
+static bool find_entry(uint32_t dir, const char *name, struct dir_entry *entry, uint32_t *index) {
+    struct fs_dentry *d = lookup(dir, name);
+    if (d == NULL || d->inode == 0) {
+        return FALSE;
+    }
+
+    if (entry) {
+        mem_set(entry, 0, sizeof(struct dir_entry));
+        entry->inode = d->inode;
+        entry->parent_inode = dir;
+        entry->type = d->type;
+        entry->name_len = str_len(d->name);
+        str_cpy(entry->name, d->name);
+    }
+    if (index) *index = d->index;
+    return TRUE;
+}
+
+// Helper: Walk a path to the directory holding its last component.
+// Absolute paths start at the root and relative ones at the working
+// directory; "." and ".." are followed and repeated slashes ignored.
+// The last component goes to 'leaf', which is left empty when the path
+// names a directory by itself ("/", "..", "a/.").
+static bool walk_parent(const char *path, uint32_t *dir, char *leaf) {
+    uint32_t cur = (*path == '/') ? fs.sb.root_inode : fs.cwd_inode;
+    leaf[0] = '\0';
+
+    while (*path != '\0') {
+        while (*path == '/') path++;
+        if (*path == '\0') break;
+
+        // Cut out the next component
+        char name[FS_MAX_FILENAME];
+        uint32_t len = 0;
+        while (path[len] != '\0' && path[len] != '/') {
+            if (len == FS_MAX_FILENAME - 1) return FALSE;   // Name too long
+            name[len] = path[len];
+            len++;
+        }
+        name[len] = '\0';
+        path += len;
+
+        bool last = TRUE;
+        for (const char *p = path; *p != '\0'; p++) {
+            if (*p != '/') {
+                last = FALSE;
+                break;
+            }
+        }
+
+        if (str_cmp(name, ".") == 0) {
+            continue;
+        }
+        if (str_cmp(name, "..") == 0) {
+            struct inode inode;
+            if (cur != fs.sb.root_inode) {
+                if (!read_inode(cur, &inode)) return FALSE;
+                cur = inode.parent_inode;
+            }
+            continue;
+        }
+        if (last) {
+            str_cpy(leaf, name);
+            break;
+        }
+
+        struct fs_dentry *d = lookup(cur, name);
+        if (d == NULL || d->inode == 0 || d->type != INODE_TYPE_DIR) {
+            return FALSE;
+        }
+        cur = d->inode;
+    }
+
+    *dir = cur;
+    return TRUE;
+}
+
+// Helper: Resolve a whole path to an inode and its type
+static bool resolve(const char *path, uint32_t *inode_num, uint8_t *type) {
+    char leaf[FS_MAX_FILENAME];
+    uint32_t dir;
+
+    if (!walk_parent(path, &dir, leaf)) return FALSE;
+
+    if (leaf[0] == '\0') {
+        *inode_num = dir;
+        *type = INODE_TYPE_DIR;
+        return TRUE;
+    }
+
+    struct fs_dentry *d = lookup(dir, leaf);
+    if (d == NULL || d->inode == 0) return FALSE;
+
+    *inode_num = d->inode;
+    *type = d->type;
+    return TRUE;
+}
+
+// Helper: Name of a directory within its parent, from the dentry cache or,
+// failing that, the parent's entries
+static bool dir_name(uint32_t parent, uint32_t dir, char *name) {
+    for (uint32_t i = 0; i < FS_DCACHE_SIZE; i++) {
+        struct fs_dentry *d = &fs.dcache[i];
+        if (d->used && d->parent_inode == parent && d->inode == dir) {
+            str_cpy(name, d->name);
+            return TRUE;
+        }
+    }
+
+    struct dir_entry e;
+    uint32_t index;
+    if (!dir_scan(parent, dir, &e, &index) || index == FS_DIR_NONE) {
+        return FALSE;
+    }
+
+    str_cpy(name, e.name);
+    dcache_add(parent, e.name, e.inode, e.type, index);
+    return TRUE;
+}
+
+// Helper: Absolute path of a directory, following parent links to the root.
+// Every component takes at least two characters, which bounds the depth.
+static bool build_path(uint32_t dir, char *path) {
+    uint32_t chain[FS_MAX_PATH / 2];
+    uint32_t depth = 0;
+
+    while (dir != fs.sb.root_inode) {
+        struct inode inode;
+        if (depth == FS_MAX_PATH / 2 || !read_inode(dir, &inode)) return FALSE;
+        chain[depth++] = dir;
+        dir = inode.parent_inode;
+    }
+
+    str_cpy(path, "/");
+    uint32_t len = 0;
+    for (uint32_t i = depth; i > 0; i--) {
+        char name[FS_MAX_FILENAME];
+        uint32_t parent = (i == depth) ? fs.sb.root_inode : chain[i];
+        if (!dir_name(parent, chain[i - 1], name)) return FALSE;
+
+        uint32_t n = str_len(name);
+        if (len + 1 + n >= FS_MAX_PATH) return FALSE;
+        path[len++] = '/';
+        str_cpy(path + len, name);
+        len += n;
+    }
+    return TRUE;
+}
+
+void fs_init(void) {
+    bcache_init();
+
+    fs.mounted = FALSE;
+    fs.cwd_inode = 0;
+    str_cpy(fs.cwd_path, "/");
+    mem_set(fs.ra, 0, sizeof(fs.ra));
+    mem_set(fs.files, 0, sizeof(fs.files));
+    dcache_reset();
+    fs.journal_active = FALSE;
+    fs.txn_count = 0;
+    fs.txn_revoke_count = 0;
+
+    // Try to mount existing filesystem
+    if (!fs_mount()) {
+        vga_puts("[*] No filesystem found. Use 'format' to create one.\n");
+    }
+}
+
+bool fs_format(uint32_t cluster_size, uint32_t inode_count) {
+    if (cluster_size == 0) cluster_size = FS_DEFAULT_CLUSTER_SIZE;
+    if (cluster_size < FS_MIN_CLUSTER_SIZE || cluster_size > FS_MAX_CLUSTER_SIZE ||
+        (cluster_size & (cluster_size - 1)) != 0) {
+        return FALSE;
+    }
+    if (inode_count != 0 && (inode_count < FS_MIN_INODES || inode_count > FS_MAX_INODES)) {
+        return FALSE;
+    }
+
+    // Size the volume from the drive (sector numbers are 32-bit on disk)
+    uint32_t total_sectors = FS_DEFAULT_SECTORS;
+    struct ata_drive *drive = ata_get_drive(0);
+    if (drive != NULL && drive->present && drive->size_sectors != 0) {
+        total_sectors = drive->size_sectors > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)drive->size_sectors;
+    }
+
+    // One inode per FS_BYTES_PER_INODE unless given, in whole table sectors
+    if (inode_count == 0) {
+        inode_count = total_sectors / (FS_BYTES_PER_INODE / FS_SECTOR_SIZE);
+        if (inode_count < FS_MIN_INODES) inode_count = FS_MIN_INODES;
+        if (inode_count > FS_MAX_INODES) inode_count = FS_MAX_INODES;
+    }
+    inode_count = (inode_count + FS_INODES_PER_SECTOR - 1) & ~(FS_INODES_PER_SECTOR - 1);
+
+    uint32_t inode_sectors = inode_count / FS_INODES_PER_SECTOR;
+    uint32_t imap_sectors = (inode_count + FS_BITS_PER_SECTOR - 1) / FS_BITS_PER_SECTOR;
+    uint32_t csum_sectors = (total_sectors + FS_CSUMS_PER_SECTOR - 1) / FS_CSUMS_PER_SECTOR;
+    uint32_t csum_start = FS_INODE_START_SECTOR + inode_sectors + imap_sectors;
+    uint32_t bitmap_start = csum_start + csum_sectors;
+    uint32_t cluster_sectors = cluster_size / FS_SECTOR_SIZE;
+    if (bitmap_start >= total_sectors ||
+        (total_sectors - bitmap_start) / cluster_sectors < 2) {
+        return FALSE;  // Tables would not leave room for data
+    }
+
+    mem_set(fs.ra, 0, sizeof(fs.ra));
+    mem_set(fs.files, 0, sizeof(fs.files));
+    dcache_reset();
+    journal_abort();
+
+    // Nothing cached from the old volume may be written over the new one
+    bcache_reset();
+    fs.csum_active = FALSE;
+    fs.csum_sector = -1;
+    fs.imap_sector = -1;
+    fs.imap_dirty = FALSE;
+    fs.imap_hint = 0;
+    fs.bmap_sector = -1;
+    fs.bmap_dirty = FALSE;
+    fs.ext_sector = 0;
+    fs.cmap_sector = 0;
+    fs.chunk_map = 0;
+
+    // Initialize superblock
+    mem_set(&fs.sb, 0, sizeof(struct superblock));
+    fs.sb.magic = FS_MAGIC;
+    fs.sb.version = FS_VERSION;
+    fs.sb.total_sectors = total_sectors;
+    fs.sb.inode_count = inode_count;
+    fs.sb.inode_start = FS_INODE_START_SECTOR;
+    fs.sb.inode_bitmap_start = FS_INODE_START_SECTOR + inode_sectors;
+    fs.sb.inode_bitmap_sectors = imap_sectors;
+    fs.sb.csum_start = csum_start;
+    fs.sb.csum_sectors = csum_sectors;
+    fs.sb.free_inodes = inode_count;  // Root is taken below
+    fs.sb.root_inode = 0;
+
+    fs.sb.cluster_sectors = cluster_sectors;
+
+    // Free-cluster bitmap sits in front of the data area it covers
+    uint32_t span = (fs.sb.total_sectors - bitmap_start) / fs.sb.cluster_sectors;
+    fs.sb.bitmap_start = bitmap_start;
+    fs.sb.bitmap_sectors = (span + FS_BITS_PER_SECTOR - 1) / FS_BITS_PER_SECTOR;
+    fs.sb.data_start = fs.sb.bitmap_start + fs.sb.bitmap_sectors;
+    fs.sb.data_blocks = (fs.sb.total_sectors - fs.sb.data_start) / fs.sb.cluster_sectors;
+    fs.sb.free_data_blocks = fs.sb.data_blocks;
+    fs.sb.next_free_block = fs.sb.data_start;
+
+    // Write superblock
+    if (!write_super()) {
+        return FALSE;
+    }
+
+    // Clear the inode table, both bitmaps and the checksum table, which lie
+    // back to back; checksums are kept from then on
+    if (!zero_sectors(fs.sb.inode_start, fs.sb.data_start - fs.sb.inode_start)) {
+        return FALSE;
+    }
+    fs.csum_active = TRUE;
+
+    if (!journal_create()) {
+        return FALSE;
+    }
+
+    // Create root directory inode
+    struct inode root_inode;
+    mem_set(&root_inode, 0, sizeof(struct inode));
+    root_inode.type = INODE_TYPE_DIR;
+    root_inode.size = 0;
+    root_inode.parent_inode = 0;  // Root is its own parent
+    if (!write_inode(0, &root_inode)) {
+        return FALSE;
+    }
+
+    // Mount the new filesystem
+    fs.mounted = TRUE;
+    fs.cwd_inode = 0;
+    str_cpy(fs.cwd_path, "/");
+
+    if (!fs_sync()) {
+        return FALSE;
+    }
+    journal_open();
+    return TRUE;
+}
+
+bool fs_mount(void) {
+    // Commit whatever a previous mount still has pending
+    if (fs.mounted && !fs_sync()) {
+        return FALSE;
+    }
+    fs.mounted = FALSE;
+    mem_set(fs.files, 0, sizeof(fs.files));
+    dcache_reset();
+    journal_abort();
+    fs.csum_active = FALSE;
+
+    // Read superblock
+    if (!read_sector(FS_SUPERBLOCK_SECTOR, fs.sector_buf)) {
+        return FALSE;
+    }
+
+    mem_cpy(&fs.sb, fs.sector_buf, sizeof(struct superblock));
+
+    // Verify magic number
+    if (fs.sb.magic != FS_MAGIC) {
+        return FALSE;
+    }
+
+    if (fs.sb.version > FS_VERSION) {
+        return FALSE;
+    }
+
+    // Bring metadata up to date from the journal, then reread the superblock
+    if (fs.sb.version >= 5 && fs.sb.journal_sectors > 1) {
+        if (!journal_replay() || !read_sector(FS_SUPERBLOCK_SECTOR, fs.sector_buf)) {
+            return FALSE;
+        }
+        mem_cpy(&fs.sb, fs.sector_buf, sizeof(struct superblock));
+    }
+
+    fs.bmap_sector = -1;
+    fs.bmap_dirty = FALSE;
+    fs.imap_sector = -1;
+    fs.imap_dirty = FALSE;
+    fs.imap_hint = 0;
+    fs.ext_sector = 0;
+    fs.cmap_sector = 0;
+    fs.chunk_map = 0;
+
+    // Upgrade older volumes one version at a time (all used one-sector
+    // clusters, and none has an inode bitmap until the last step)
+    if (fs.sb.version < 4) {
+        fs.sb.cluster_sectors = 1;
+    }
+    if (fs.sb.version < 8) {
+        fs.sb.inode_bitmap_start = 0;
+        fs.sb.inode_bitmap_sectors = 0;
+    }
+    if (fs.sb.version < 10) {
+        fs.sb.csum_start = 0;
+        fs.sb.csum_sectors = 0;
+    }
+    fs.csum_active = fs.sb.csum_sectors > 0;
+    fs.csum_sector = -1;
+    if (fs.sb.version == 1 && !migrate_v1()) {
+        return FALSE;
+    }
+    if (fs.sb.version == 2 && !migrate_v2()) {
+        return FALSE;
+    }
+    if (fs.sb.version == 3 && !migrate_v3()) {
+        return FALSE;
+    }
+    if (fs.sb.version == 4 && !migrate_v4()) {
+        return FALSE;
+    }
+    if (fs.sb.version == 5 && !migrate_v5()) {
+        return FALSE;
+    }
+    if (fs.sb.version == 6 && !migrate_v6()) {
+        return FALSE;
+    }
+    if (fs.sb.version == 7 && !migrate_v7()) {
+        return FALSE;
+    }
+    if (fs.sb.version == 8 && !migrate_v8()) {
+        return FALSE;
+    }
+    if (fs.sb.version == 9 && !migrate_v9()) {
+        return FALSE;
+    }
+    if (fs.sb.version == 10 && !migrate_v10()) {
+        return FALSE;
+    }
+
+    journal_open();
+    fs.mounted = TRUE;
+    fs.cwd_inode = fs.sb.root_inode;
+    str_cpy(fs.cwd_path, "/");
+
+    return TRUE;
+}
+
+bool fs_sync(void) {
+    // Hand dirty inodes and bitmap to the cache; with a journal, committing
+    // makes them durable, otherwise write everything back and flush
+    if (!imap_flush() || !bmap_flush()) return FALSE;
+    if (fs.journal_active) return journal_commit();
+    if (!bcache_sync()) return FALSE;
+    return ata_flush(0);
+}
+
+bool fs_is_mounted(void) {
+    return fs.mounted;
+}
+
+const char* fs_get_cwd(void) {
+    return fs.cwd_path;
+}
+
+uint32_t fs_get_cwd_inode(void) {
+    return fs.cwd_inode;
+}
+
+// Helper: Add a new entry of 'type' named 'name' to a directory. New
+// entries inherit the directory's compression setting.
+static bool make_entry(uint32_t dir, const char *name, uint8_t type) {
+    // Check the name is not taken
+    if (find_entry(dir, name, NULL, NULL)) {
+        return FALSE;
+    }
+
+    struct inode parent;
+    if (!read_inode(dir, &parent) || parent.type != INODE_TYPE_DIR) {
+        return FALSE;
+    }
+
+    // The inode and its entry go in together, in one step
+    if (!dir_make_room(dir) || !journal_reserve(FS_JOURNAL_STEP_SECTORS, 0)) {
+        return FALSE;
+    }
+
+    // Allocate inode
+    int32_t new_inode = alloc_inode();
+    if (new_inode < 0) return FALSE;
+
+    // Create inode; file data stays in the inode while it fits
+    struct inode inode;
+    mem_set(&inode, 0, sizeof(struct inode));
+    inode.type = type;
+    inode.flags = (type == INODE_TYPE_FILE) ? INODE_FLAG_INLINE : 0;
+    inode.flags |= parent.flags & INODE_FLAG_COMPRESSED;
+    inode.size = 0;
+    inode.parent_inode = dir;
+    if (!write_inode(new_inode, &inode)) {
+        return FALSE;
+    }
+
+    // Add it to the parent, giving the inode back if that fails
+    uint32_t index;
+    if (!dir_add(dir, name, new_inode, type, &index)) {
+        mem_set(&inode, 0, sizeof(struct inode));
+        write_inode(new_inode, &inode);
+        return FALSE;
+    }
+
+    dcache_add(dir, name, new_inode, type, index);
+    return TRUE;
+}
+
+bool fs_mkdir(const char *path) {
+    char name[FS_MAX_FILENAME];
+    uint32_t dir;
+
+    if (!fs.mounted || !walk_parent(path, &dir, name) || name[0] == '\0') {
+        return FALSE;
+    }
+    return make_entry(dir, name, INODE_TYPE_DIR);
+}
+
+bool fs_chdir(const char *path) {
+    if (!fs.mounted) return FALSE;
+
+    uint32_t inode_num;
+    uint8_t type;
+    if (!resolve(path, &inode_num, &type) || type != INODE_TYPE_DIR) {
+        return FALSE;  // Missing or not a directory
+    }
+
+    // Name the new directory from the dentry cache before switching to it
+    char cwd_path[FS_MAX_PATH];
+    if (!build_path(inode_num, cwd_path)) {
+        return FALSE;
+    }
+
+    fs.cwd_inode = inode_num;
+    str_cpy(fs.cwd_path, cwd_path);
+    return TRUE;
+}
+
+bool fs_list_dir(const char *path) {
+    if (!fs.mounted) return FALSE;
+
+    uint32_t dir = fs.cwd_inode;
+    uint8_t type;
+    if (path != NULL && (!resolve(path, &dir, &type) || type != INODE_TYPE_DIR)) {
+        return FALSE;
+    }
+
+    bool found_any = FALSE;
+
+    // Only this directory's own blocks are read
+    struct inode inode;
+    if (!read_inode(dir, &inode)) {
+        return FALSE;
+    }
+
+    uint32_t count = inode.size / sizeof(struct dir_entry);
+    uint32_t sectors = (inode.size + FS_SECTOR_SIZE - 1) / FS_SECTOR_SIZE;
+    struct fs_readahead *ra = ra_get(dir);
+
+    for (uint32_t s = 0; s < sectors; s++) {
+        if (dir_sector(&inode, s * FS_DIRENTS_PER_SECTOR) == 0) break;
+        readahead(ra, &inode, s, 1, sectors);
+
+        for (uint32_t i = 0; i < 8 && s * FS_DIRENTS_PER_SECTOR + i < count; i++) {
+            struct dir_entry *e = (struct dir_entry*)(fs.sector_buf + i * sizeof(struct dir_entry));
+            if (e->inode != 0) {
+                found_any = TRUE;
+
+                if (e->type == INODE_TYPE_DIR) {
+                    vga_set_color(VGA_LIGHT_BLUE, VGA_BLACK);
+                    vga_puts("  [DIR]  ");
+                } else {
+                    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+                    vga_puts("  [FILE] ");
+                }
+
+                vga_puts(e->name);
+
+                // Show file size for files
+                if (e->type == INODE_TYPE_FILE) {
+                    struct inode file;
+                    if (read_inode(e->inode, &file)) {
+                        vga_puts(" (");
+                        vga_put_dec(file.size);
+                        vga_puts(file.flags & INODE_FLAG_COMPRESSED ? " bytes, compressed)" : " bytes)");
+                    }
+                }
+
+                vga_putchar('\n');
+            }
+        }
+    }
+
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+
+    if (!found_any) {
+        vga_puts("  (empty directory)\n");
+    }
+
+    return TRUE;
+}
+
+// Helper: Next entry of a directory from *cursor
+static bool read_dir_at(uint32_t dir, uint32_t *cursor, struct dir_entry *entry) {
+    struct inode inode;
+    if (!read_inode(dir, &inode) || inode.type != INODE_TYPE_DIR) {
+        return FALSE;
+    }
+
+    // Resume at the cursor, skipping free slots
+    uint32_t count = inode.size / sizeof(struct dir_entry);
+    for (uint32_t i = *cursor; i < count; i++) {
+        if (i == *cursor || i % FS_DIRENTS_PER_SECTOR == 0) {
+            if (dir_sector(&inode, i) == 0) return FALSE;
+        }
+
+        struct dir_entry *e = (struct dir_entry*)(fs.sector_buf +
+                              (i % FS_DIRENTS_PER_SECTOR) * sizeof(struct dir_entry));
+        if (e->inode != 0) {
+            mem_cpy(entry, e, sizeof(struct dir_entry));
+            *cursor = i + 1;
+            return TRUE;
+        }
+    }
+
+    *cursor = count;
+    return FALSE;
+}
+
+bool fs_read_dir(const char *path, uint32_t *cursor, struct dir_entry *entry) {
+    if (!fs.mounted) return FALSE;
+
+    uint32_t dir = fs.cwd_inode;
+    uint8_t type;
+    if (path != NULL && (!resolve(path, &dir, &type) || type != INODE_TYPE_DIR)) {
+        return FALSE;
+    }
+    return read_dir_at(dir, cursor, entry);
+}
+
+bool fs_create(const char *path) {
+    char name[FS_MAX_FILENAME];
+    uint32_t dir;
+
+    if (!fs.mounted || !walk_parent(path, &dir, name) || name[0] == '\0') {
+        return FALSE;
+    }
+    return make_entry(dir, name, INODE_TYPE_FILE);
+}
+
+bool fs_exists(const char *path) {
+    uint32_t inode_num;
+    uint8_t type;
+    return fs.mounted && resolve(path, &inode_num, &type);
+}
+
+bool fs_open(const char *path, uint32_t *inode_num) {
+    uint8_t type;
+    return fs.mounted && resolve(path, inode_num, &type);
+}
+
+// Helper: Read bytes [off, off + len) of a file into dst. Whole sectors go
+// straight to dst (or come out of the cache if readahead got there first);
+// partial ones at either edge are copied out of a cached sector.
+static bool read_range(uint32_t inode_num, const struct inode *inode,
+                       uint8_t *dst, uint32_t off, uint32_t len) {
+    // Inline data came in with the inode table: no I/O at all
+    if (inode->flags & INODE_FLAG_INLINE) {
+        mem_cpy(dst, inode->inline_data + off, len);
+        return TRUE;
+    }
+    if (is_compressed(inode)) {
+        return read_chunks(inode, dst, off, len);
+    }
+
+    uint32_t blocks = (inode->size + FS_SECTOR_SIZE - 1) / FS_SECTOR_SIZE;
+    if (blocks > inode->block_count * fs.sb.cluster_sectors) return FALSE;
+    if (len == 0) return TRUE;
+
+    uint32_t first = off / FS_SECTOR_SIZE;
+    uint32_t end = (off + len + FS_SECTOR_SIZE - 1) / FS_SECTOR_SIZE;
+
+    while (len > 0) {
+        uint32_t sector = off / FS_SECTOR_SIZE;
+        uint32_t within = off % FS_SECTOR_SIZE;
+        uint32_t n;
+
+        if (within != 0 || len < FS_SECTOR_SIZE) {
+            uint32_t lba;
+            if (map_block(inode, sector, sector + 1, &lba) == 0) return FALSE;
+
+            // Only a read that finishes the sector is done with its buffer
+            n = FS_SECTOR_SIZE - within;
+            if (n > len) n = len;
+            if (within + n < FS_SECTOR_SIZE || !bcache_read_cached(0, lba, fs.sector_buf)) {
+                if (!read_sector(lba, fs.sector_buf)) return FALSE;
+            } else if (!csum_verify(lba, 1, fs.sector_buf)) {
+                return FALSE;
+            }
+            mem_cpy(dst, fs.sector_buf + within, n);
+        } else {
+            uint32_t count = len / FS_SECTOR_SIZE;
+            if (!read_blocks(inode, sector, count, dst)) return FALSE;
+            n = count * FS_SECTOR_SIZE;
+        }
+
+        off += n;
+        dst += n;
+        len -= n;
+    }
+
+    // Queue readahead once the data is copied out, so it cannot reuse a
+    // buffer this read still needed. A read that starts inside the sector
+    // the last one ended in continues the same stream rather than seeking.
+    struct fs_readahead *ra = ra_get(inode_num);
+    if (first + 1 == ra->next_block) first++;
+    if (first < end) readahead(ra, inode, first, end - first, blocks);
+    return TRUE;
+}
+
+// Helper: Write bytes [off, off + len) of a file from src, or zeros if src
+// is NULL. The clusters must already be allocated. Whole sectors are written
+// straight from src; a partial one is merged with its old contents when it
+// holds any of the first 'valid' bytes, and everything past 'valid' in it is
+// zeroed so a grown file never exposes stale data.
+static bool write_range(const struct inode *inode, const uint8_t *src,
+                        uint32_t off, uint32_t len, uint32_t valid) {
+    uint32_t sectors = inode->block_count * fs.sb.cluster_sectors;
+
+    if (is_compressed(inode)) {
+        return write_chunks(inode, src, off, len, valid);
+    }
+
+    while (len > 0) {
+        uint32_t sector = off / FS_SECTOR_SIZE;
+        uint32_t within = off % FS_SECTOR_SIZE;
+        uint32_t lba;
+        uint32_t run = map_block(inode, sector, sectors, &lba);
+        uint32_t n;
+        if (run == 0) return FALSE;
+
+        if (within != 0 || len < FS_SECTOR_SIZE) {
+            uint32_t base = sector * FS_SECTOR_SIZE;
+            n = FS_SECTOR_SIZE - within;
+            if (n > len) n = len;
+
+            if (base < valid) {
+                if (!read_sector(lba, fs.sector_buf)) return FALSE;
+                if (valid < base + FS_SECTOR_SIZE) {
+                    mem_set(fs.sector_buf + (valid - base), 0, base + FS_SECTOR_SIZE - valid);
+                }
+            } else {
+                mem_set(fs.sector_buf, 0, FS_SECTOR_SIZE);
+            }
+
+            if (src != NULL) {
+                mem_cpy(fs.sector_buf + within, src, n);
+            } else {
+                mem_set(fs.sector_buf + within, 0, n);
+            }
+            if (!write_sectors(lba, 1, fs.sector_buf)) return FALSE;
+        } else {
+            uint32_t count = len / FS_SECTOR_SIZE;
+            if (run > count) run = count;
+            if (src == NULL && run > sizeof(zero_buf) / FS_SECTOR_SIZE) {
+                run = sizeof(zero_buf) / FS_SECTOR_SIZE;
+            }
+            if (!write_sectors(lba, run, src != NULL ? src : zero_buf)) return FALSE;
+            n = run * FS_SECTOR_SIZE;
+        }
+
+        off += n;
+        len -= n;
+        if (src != NULL) src += n;
+    }
+    return TRUE;
+}
+
+// Helper: Move an inline file's data out to clusters; the caller grows it
+// from there. The inode records the data's size only once it is written,
+// so a crash part way never exposes what the clusters held before. If that
+// fails the file stays inline and unchanged.
+static bool uninline(uint32_t inode_num, struct inode *inode) {
+    uint8_t data[FS_INLINE_SIZE];
+    uint32_t used = inode->size;
+
+    mem_cpy(data, inode->inline_data, used);
+    mem_set(inode->inline_data, 0, FS_INLINE_SIZE);
+    inode->flags &= ~INODE_FLAG_INLINE;
+    inode->size = 0;
+
+    if (!resize_clusters(inode_num, inode, used) || !write_range(inode, data, 0, used, 0)) {
+        shrink_blocks(inode_num, inode, 0);
+        mem_set(inode->inline_data, 0, FS_INLINE_SIZE);
+        mem_cpy(inode->inline_data, data, used);
+        inode->flags |= INODE_FLAG_INLINE;
+        inode->size = used;
+        if (journal_reserve(2, 0)) write_inode(inode_num, inode);
+        return FALSE;
+    }
+
+    inode->size = used;
+    return journal_reserve(2, 0) && write_inode(inode_num, inode);
+}
+
+// Helper: Open file for a handle, NULL if the handle is not valid
+static struct fs_file *get_file(int32_t fd) {
+    if (!fs.mounted || fd < 0 || fd >= FS_MAX_OPEN_FILES || !fs.files[fd].used) {
+        return NULL;
+    }
+    return &fs.files[fd];
+}
+
+// Helper: Check whether any handle refers to an inode
+static bool is_open(uint32_t inode_num) {
+    for (uint32_t i = 0; i < FS_MAX_OPEN_FILES; i++) {
+        if (fs.files[i].used && fs.files[i].inode == inode_num) return TRUE;
+    }
+    return FALSE;
+}
+
+bool fs_read(uint32_t inode_num, void *buf, uint32_t *size) {
+    struct inode inode;
+    if (!read_inode(inode_num, &inode)) {
+        return FALSE;
+    }
+
+    if (inode.type != INODE_TYPE_FILE) {
+        return FALSE;
+    }
+
+    // The caller wants the whole file, so each extent is read straight into
+    // its buffer with one command
+    *size = inode.size;
+    return read_range(inode_num, &inode, buf, 0, inode.size);
+}
+
+bool fs_write(uint32_t inode_num, const void *buf, uint32_t size) {
+    struct inode inode;
+    if (!read_inode(inode_num, &inode)) {
+        return FALSE;
+    }
+
+    if (inode.type != INODE_TYPE_FILE) {
+        return FALSE;
+    }
+
+    uint32_t blocks_needed = (size + FS_SECTOR_SIZE - 1) / FS_SECTOR_SIZE;
+
+    ra_forget(inode_num);
+
+    // Small files go in the inode itself, giving back any clusters they had
+    if (size <= FS_INLINE_SIZE) {
+        if (!(inode.flags & INODE_FLAG_INLINE) && !shrink_blocks(inode_num, &inode, 0)) {
+            return FALSE;
+        }
+        mem_set(inode.inline_data, 0, FS_INLINE_SIZE);
+        mem_cpy(inode.inline_data, buf, size);
+        inode.flags |= INODE_FLAG_INLINE;
+        inode.size = size;
+        if (!journal_reserve(2, 0) || !write_inode(inode_num, &inode)) {
+            return FALSE;
+        }
+        return fs_sync();
+    }
+
+    // A file outgrowing the inode starts over with no extents
+    if (inode.flags & INODE_FLAG_INLINE) {
+        mem_set(inode.inline_data, 0, FS_INLINE_SIZE);
+        inode.flags &= ~INODE_FLAG_INLINE;
+        inode.size = 0;
+    }
+
+    if (!resize_clusters(inode_num, &inode, size)) {
+        return FALSE;
+    }
+
+    // Compressed data goes through the chunk buffer instead
+    if (is_compressed(&inode)) {
+        if (!write_range(&inode, buf, 0, size, 0)) {
+            return FALSE;
+        }
+        inode.size = size;
+        if (!journal_reserve(2, 0) || !write_inode(inode_num, &inode)) {
+            return FALSE;
+        }
+        return fs_sync();
+    }
+
+    // Write each extent with one command, straight from the caller's buffer
+    const uint8_t *src = buf;
+    uint32_t tail = size % FS_SECTOR_SIZE;
+
+    for (uint32_t i = 0; i < blocks_needed; ) {
+        uint32_t lba;
+        uint32_t run = map_block(&inode, i, blocks_needed, &lba);
+        if (run == 0) return FALSE;
+
+        uint32_t direct = run;
+
+        // A partial last sector is zero-padded in the bounce buffer
+        if (i + run == blocks_needed && tail != 0) direct--;
+
+        if (direct > 0) {
+            if (!write_sectors(lba, direct, src)) {
+                return FALSE;
+            }
+            src += direct * FS_SECTOR_SIZE;
+        }
+
+        if (direct < run) {
+            mem_set(fs.sector_buf, 0, FS_SECTOR_SIZE);
+            mem_cpy(fs.sector_buf, src, tail);
+            if (!write_sectors(lba + direct, 1, fs.sector_buf)) {
+                return FALSE;
+            }
+        }
+
+        i += run;
+    }
+
+    // Update inode
+    inode.size = size;
+    if (!journal_reserve(2, 0) || !write_inode(inode_num, &inode)) {
+        return FALSE;
+    }
+
+    // End of a file write is an ordering point: make it durable
+    return fs_sync();
+}
+
+int32_t fs_fopen(const char *path) {
+    uint32_t inode_num;
+    uint8_t type;
+
+    if (!fs.mounted || !resolve(path, &inode_num, &type) || type != INODE_TYPE_FILE) {
+        return -1;
+    }
+
+    for (int32_t fd = 0; fd < FS_MAX_OPEN_FILES; fd++) {
+        if (!fs.files[fd].used) {
+            fs.files[fd].used = TRUE;
+            fs.files[fd].inode = inode_num;
+            fs.files[fd].offset = 0;
+            return fd;
+        }
+    }
+    return -1;  // Too many open files
+}
+
+bool fs_fclose(int32_t fd) {
+    struct fs_file *file = get_file(fd);
+    if (file == NULL) return FALSE;
+
+    file->used = FALSE;
+
+    // Closing is an ordering point, like the end of fs_write
+    return fs_sync();
+}
+
+// Helper: Read up to 'len' bytes of a file from 'offset'
+static int32_t pread_inode(uint32_t inode_num, void *buf, uint32_t len, uint32_t offset) {
+    struct inode inode;
+    if (!read_inode(inode_num, &inode) || inode.type != INODE_TYPE_FILE) {
+        return -1;
+    }
+
+    if (offset >= inode.size) return 0;
+    if (len > inode.size - offset) len = inode.size - offset;
+    if (len > 0x7FFFFFFF) len = 0x7FFFFFFF;
+
+    if (!read_range(inode_num, &inode, buf, offset, len)) {
+        return -1;
+    }
+    return (int32_t)len;
+}
+
+int32_t fs_pread(int32_t fd, void *buf, uint32_t len, uint32_t offset) {
+    struct fs_file *file = get_file(fd);
+    if (file == NULL) return -1;
+
+    return pread_inode(file->inode, buf, len, offset);
+}
+
+// Helper: Write 'len' bytes of a file at 'offset', growing it as needed
+static int32_t pwrite_inode(uint32_t inode_num, const void *buf, uint32_t len, uint32_t offset) {
+    struct inode inode;
+    if (!read_inode(inode_num, &inode) || inode.type != INODE_TYPE_FILE) {
+        return -1;
+    }
+
+    uint32_t end = offset + len;
+    if (end < offset || end > 0x7FFFFFFF) return -1;
+    if (len == 0) return 0;
+
+    uint32_t old_size = inode.size;
+
+    // Small files stay in the inode until a write takes them past it
+    if (inode.flags & INODE_FLAG_INLINE) {
+        if (end <= FS_INLINE_SIZE) {
+            if (offset > old_size) mem_set(inode.inline_data + old_size, 0, offset - old_size);
+            mem_cpy(inode.inline_data + offset, buf, len);
+            if (end > old_size) inode.size = end;
+            return journal_reserve(2, 0) && write_inode(inode_num, &inode) ? (int32_t)len : -1;
+        }
+        if (!uninline(inode_num, &inode)) {
+            return -1;
+        }
+    }
+
+    if (end > old_size) {
+        if (!resize_clusters(inode_num, &inode, end)) {
+            return -1;
+        }
+
+        // Whole sectors between the old end and the write must read back as
+        // zeros; write_range clears the rest of any partial sector itself
+        uint32_t gap_end = offset - offset % FS_SECTOR_SIZE;
+        if (gap_end > old_size && !write_range(&inode, NULL, old_size, gap_end - old_size, old_size)) {
+            return -1;
+        }
+    }
+
+    if (!write_range(&inode, buf, offset, len, old_size)) {
+        return -1;
+    }
+
+    if (end > old_size) {
+        inode.size = end;
+        if (!journal_reserve(2, 0) || !write_inode(inode_num, &inode)) {
+            return -1;
+        }
+    }
+    return (int32_t)len;
+}
+
+int32_t fs_pwrite(int32_t fd, const void *buf, uint32_t len, uint32_t offset) {
+    struct fs_file *file = get_file(fd);
+    if (file == NULL) return -1;
+
+    return pwrite_inode(file->inode, buf, len, offset);
+}
+
+int32_t fs_append(int32_t fd, const void *buf, uint32_t len) {
+    struct fs_file *file = get_file(fd);
+    struct inode inode;
+
+    if (file == NULL || !read_inode(file->inode, &inode)) {
+        return -1;
+    }
+
+    int32_t written = fs_pwrite(fd, buf, len, inode.size);
+    if (written >= 0) {
+        file->offset = inode.size + (uint32_t)written;
+    }
+    return written;
+}
+
+int32_t fs_fread(int32_t fd, void *buf, uint32_t len) {
+    struct fs_file *file = get_file(fd);
+    if (file == NULL) return -1;
+
+    int32_t n = fs_pread(fd, buf, len, file->offset);
+    if (n > 0) file->offset += (uint32_t)n;
+    return n;
+}
+
+int32_t fs_fwrite(int32_t fd, const void *buf, uint32_t len) {
+    struct fs_file *file = get_file(fd);
+    if (file == NULL) return -1;
+
+    int32_t n = fs_pwrite(fd, buf, len, file->offset);
+    if (n > 0) file->offset += (uint32_t)n;
+    return n;
+}
+
+int32_t fs_seek(int32_t fd, int32_t offset, int whence) {
+    struct fs_file *file = get_file(fd);
+    struct inode inode;
+
+    if (file == NULL || !read_inode(file->inode, &inode)) {
+        return -1;
+    }
+
+    int64_t base;
+    switch (whence) {
+        case FS_SEEK_SET: base = 0; break;
+        case FS_SEEK_CUR: base = file->offset; break;
+        case FS_SEEK_END: base = inode.size; break;
+        default: return -1;
+    }
+
+    // Seeking past the end is allowed; a later write fills the gap with zeros
+    int64_t pos = base + offset;
+    if (pos < 0 || pos > 0x7FFFFFFF) return -1;
+
+    file->offset = (uint32_t)pos;
+    return (int32_t)pos;
+}
+
+// Helper: Set a file's size, zero-filling when it grows
+static bool truncate_inode(uint32_t inode_num, uint32_t size) {
+    struct inode inode;
+    if (!read_inode(inode_num, &inode) || inode.type != INODE_TYPE_FILE || size > 0x7FFFFFFF) {
+        return FALSE;
+    }
+
+    uint32_t old_size = inode.size;
+
+    if (inode.flags & INODE_FLAG_INLINE) {
+        if (size <= FS_INLINE_SIZE) {
+            if (size > old_size) mem_set(inode.inline_data + old_size, 0, size - old_size);
+            inode.size = size;
+            return journal_reserve(2, 0) && write_inode(inode_num, &inode);
+        }
+        if (!uninline(inode_num, &inode)) {
+            return FALSE;
+        }
+    }
+
+    if (size < old_size) ra_forget(inode_num);
+    if (!resize_clusters(inode_num, &inode, size)) {
+        return FALSE;
+    }
+
+    // Growing exposes the bytes past the old end: make them zeros
+    if (size > old_size && !write_range(&inode, NULL, old_size, size - old_size, old_size)) {
+        return FALSE;
+    }
+
+    inode.size = size;
+    return journal_reserve(2, 0) && write_inode(inode_num, &inode);
+}
+
+bool fs_truncate(int32_t fd, uint32_t size) {
+    struct fs_file *file = get_file(fd);
+    if (file == NULL) return FALSE;
+
+    return truncate_inode(file->inode, size);
+}
+
+// Helper: Remove entry 'name' from a directory, freeing its inode
+static bool remove_entry(uint32_t dir, const char *name) {
+    struct dir_entry entry;
+    uint32_t index;
+
+    if (!find_entry(dir, name, &entry, &index)) {
+        return FALSE;
+    }
+
+    // For directories, check if empty
     struct inode inode;
+    if (!read_inode(entry.inode, &inode)) {
+        return FALSE;
+    }
+    if (inode.type == INODE_TYPE_DIR && inode.child_count != 0) {
+        return FALSE;  // Directory not empty
+    }
+
+    // Refuse while handles still refer to the file, or for the working directory
+    if (is_open(entry.inode) || entry.inode == fs.cwd_inode) {
+        return FALSE;
+    }
+
+    // Free its blocks, then clear the inode. The entry only goes once both
+    // have worked, so a failure never leaves an inode nothing refers to.
+    ra_forget(entry.inode);
+    if (!(inode.flags & INODE_FLAG_INLINE) && !shrink_blocks(entry.inode, &inode, 0)) {
+        return FALSE;
+    }
     mem_set(&inode, 0, sizeof(struct inode));
-    write_inode(entry.inode, &inode);
+    if (!journal_reserve(FS_JOURNAL_STEP_SECTORS, 0) || !write_inode(entry.inode, &inode)) {
+        return FALSE;
+    }
 
     // Clear directory entry
-    if (!read_sector(entry_sector, fs.sector_buf)) {
+    if (!dir_remove(dir, index)) {
         return FALSE;
     }
 
-    struct dir_entry *e = (struct dir_entry*)(fs.sector_buf + entry_offset);
-    mem_set(e, 0, sizeof(struct dir_entry));
+    dcache_add(dir, name, 0, INODE_TYPE_FREE, FS_DIR_NONE);
+    if (entry.type == INODE_TYPE_DIR) dcache_purge(entry.inode);
+    return TRUE;
+}
+
+bool fs_delete(const char *path) {
+    char name[FS_MAX_FILENAME];
+    uint32_t dir;
+
+    if (!fs.mounted || !walk_parent(path, &dir, name) || name[0] == '\0') {
+        return FALSE;
+    }
+    return remove_entry(dir, name);
+}
+
+// Helper: Convert a file to or from compressed chunks, or change what a
+// directory passes on
+static bool set_compressed(uint32_t inode_num, bool on) {
+    struct inode inode;
+    if (!read_inode(inode_num, &inode)) {
+        return FALSE;
+    }
+    if (((inode.flags & INODE_FLAG_COMPRESSED) != 0) == on) {
+        return TRUE;
+    }
+
+    // A directory or an inline file only records the setting
+    if (inode.type != INODE_TYPE_FILE || (inode.flags & INODE_FLAG_INLINE)) {
+        if (on) {
+            inode.flags |= INODE_FLAG_COMPRESSED;
+        } else {
+            inode.flags &= ~INODE_FLAG_COMPRESSED;
+        }
+        if (inode.type == INODE_TYPE_FILE) inode.chunk_map = 0;
+        return journal_reserve(2, 0) && write_inode(inode_num, &inode) && fs_sync();
+    }
+
+    ra_forget(inode_num);
+
+    if (!on) {
+        return expand_chunks(inode_num, &inode) &&
+               resize_clusters(inode_num, &inode, inode.size) && fs_sync();
+    }
+
+    if (inode.size > FS_COMPRESS_MAX_SIZE) {
+        return FALSE;
+    }
+
+    // Round the clusters up to whole chunks while the file is still plain,
+    // then switch it over in one step with every chunk marked as stored as
+    // is, which is what the plain layout already is, and compress them one
+    // by one in place
+    uint32_t chunks = (inode.size + FS_CHUNK_SIZE - 1) / FS_CHUNK_SIZE;
+    if (!resize_clusters(inode_num, &inode, chunks * FS_CHUNK_SIZE)) {
+        resize_clusters(inode_num, &inode, inode.size);     // Drop any clusters added
+        return FALSE;
+    }
+
+    if (!journal_reserve(FS_JOURNAL_STEP_SECTORS, 0)) return FALSE;
+    if (chunks > 0) {
+        uint32_t lba;
+        if (alloc_run(1, 0, &lba) == 0) return FALSE;
 
-    return write_sector(entry_sector, fs.sector_buf);
+        mem_set(fs.cmap_buf, 0, FS_SECTOR_SIZE);
+        mem_set(fs.cmap_buf, FS_CHUNK_SECTORS, chunks);
+        fs.cmap_sector = lba;
+        inode.chunk_map = lba;
+        if (!write_sector(lba, fs.cmap_buf)) return FALSE;
+    }
+    inode.flags |= INODE_FLAG_COMPRESSED;
+    if (!write_inode(inode_num, &inode)) return FALSE;
+
+    // Only the sectors holding data are read: the rest of the last slot
+    // was just allocated and holds whatever was there before
+    uint32_t sectors = (inode.size + FS_SECTOR_SIZE - 1) / FS_SECTOR_SIZE;
+    for (uint32_t k = 0; k < chunks; k++) {
+        uint32_t base = k * FS_CHUNK_SIZE;
+        uint32_t count = sectors - k * FS_CHUNK_SECTORS;
+        if (count > FS_CHUNK_SECTORS) count = FS_CHUNK_SECTORS;
+
+        fs.chunk_map = 0;
+        if (!read_blocks(&inode, k * FS_CHUNK_SECTORS, count, fs.chunk_buf)) {
+            return FALSE;
+        }
+        if (inode.size < base + FS_CHUNK_SIZE) {
+            mem_set(fs.chunk_buf + (inode.size - base), 0, base + FS_CHUNK_SIZE - inode.size);
+        }
+        if (!chunk_store(&inode, k)) return FALSE;
+    }
+    return fs_sync();
+}
+
+bool fs_set_compressed(const char *path, bool on) {
+    uint32_t inode_num;
+    uint8_t type;
+
+    if (!fs.mounted || !resolve(path, &inode_num, &type)) {
+        return FALSE;
+    }
+    return set_compressed(inode_num, on);
+}
+
+void fs_get_csum_stats(struct fs_csum_stats *stats) {
+    mem_cpy(stats, &fs.csum_stats, sizeof(struct fs_csum_stats));
 }
 
-bool fs_get_entry(const char *name, struct dir_entry *entry) {
-    return find_entry(name, entry, NULL, NULL);
+bool fs_get_entry(const char *path, struct dir_entry *entry) {
+    char name[FS_MAX_FILENAME];
+    uint32_t dir;
+
+    if (!fs.mounted || !walk_parent(path, &dir, name) || name[0] == '\0') {
+        return FALSE;
+    }
+    return find_entry(dir, name, entry, NULL);
 }
 
 bool fs_get_inode(uint32_t inode_num, struct inode *inode) {
     return read_inode(inode_num, inode);
 }
+
+// VFS operations: nodes are inode numbers
+static uint32_t vn_root(void) {
+    return fs.sb.root_inode;
+}
+
+static bool vn_lookup(uint32_t dir, const char *name, uint32_t *node, uint8_t *type) {
+    struct dir_entry entry;
+    if (!fs.mounted || !find_entry(dir, name, &entry, NULL)) {
+        return FALSE;
+    }
+
+    *node = entry.inode;
+    *type = entry.type;
+    return TRUE;
+}
+
+static bool vn_create(uint32_t dir, const char *name, uint8_t type) {
+    return fs.mounted && make_entry(dir, name, type);
+}
+
+static bool vn_remove(uint32_t dir, const char *name) {
+    return fs.mounted && remove_entry(dir, name);
+}
+
+static bool vn_read_dir(uint32_t dir, uint32_t *cursor, struct dir_entry *entry) {
+    return fs.mounted && read_dir_at(dir, cursor, entry);
+}
+
+static int32_t vn_read(uint32_t node, void *buf, uint32_t len, uint32_t offset) {
+    return fs.mounted ? pread_inode(node, buf, len, offset) : -1;
+}
+
+static int32_t vn_write(uint32_t node, const void *buf, uint32_t len, uint32_t offset) {
+    return fs.mounted ? pwrite_inode(node, buf, len, offset) : -1;
+}
+
+static bool vn_truncate(uint32_t node, uint32_t size) {
+    return fs.mounted && truncate_inode(node, size);
+}
+
+static bool vn_getattr(uint32_t node, struct vnode_attr *attr) {
+    struct inode inode;
+    if (!fs.mounted || !read_inode(node, &inode) || inode.type == INODE_TYPE_FREE) {
+        return FALSE;
+    }
+
+    attr->type = inode.type;
+    attr->flags = inode.flags & INODE_FLAG_COMPRESSED;
+    attr->size = inode.size;
+    return TRUE;
+}
+
+static bool vn_set_compressed(uint32_t node, bool on) {
+    return fs.mounted && set_compressed(node, on);
+}
+
+static bool vn_sync(void) {
+    // Nothing to write back without a filesystem
+    return !fs.mounted || fs_sync();
+}
+
+const struct vnode_ops fs_vnode_ops = {
+    .name           = "monkeyfs",
+    .root           = vn_root,
+    .lookup         = vn_lookup,
+    .create         = vn_create,
+    .remove         = vn_remove,
+    .read_dir       = vn_read_dir,
+    .read           = vn_read,
+    .write          = vn_write,
+    .truncate       = vn_truncate,
+    .getattr        = vn_getattr,
+    .set_compressed = vn_set_compressed,
+    .sync           = vn_sync,
+};
@@ -0,0 +1,506 @@
+#include "tmpfs.h"
+#include "vfs.h"
+#include "vga.h"
+#include "string.h"
+
+static struct tmpfs_state tmp;
+
+// Helper: Node by number, NULL if out of range or unused
+static struct tmpfs_node *get_node(uint32_t node) {
+    if (node >= TMPFS_MAX_NODES || tmp.nodes[node].type == INODE_TYPE_FREE) {
+        return NULL;
+    }
+    return &tmp.nodes[node];
+}
+
+static uint8_t *page_data(uint16_t page) {
+    return tmp.pages[page];
+}
+
+void tmpfs_init(void) {
+    mem_set(tmp.nodes, 0, sizeof(tmp.nodes));
+
+    for (uint32_t i = 1; i < TMPFS_MAX_NODES; i++) {
+        tmp.nodes[i].next_sibling = i + 1 < TMPFS_MAX_NODES ? i + 1 : TMPFS_NONE;
+    }
+    tmp.free_node = 1;
+
+    for (uint32_t i = 0; i < TMPFS_PAGES; i++) {
+        tmp.page_next[i] = i + 1 < TMPFS_PAGES ? i + 1 : TMPFS_NONE;
+    }
+    tmp.free_page = 0;
+
+    struct tmpfs_node *root = &tmp.nodes[TMPFS_ROOT];
+    root->type = INODE_TYPE_DIR;
+    root->parent = TMPFS_ROOT;
+    root->first_child = TMPFS_NONE;
+    root->next_sibling = TMPFS_NONE;
+    root->first_page = TMPFS_NONE;
+
+    tmp.stats.nodes_used = 1;
+    tmp.stats.pages_used = 0;
+}
+
+// Helper: Take a node off the free list and link it into 'dir' as 'name'
+static uint16_t node_alloc(uint16_t dir, const char *name, uint8_t type) {
+    uint16_t n = tmp.free_node;
+    if (n == TMPFS_NONE) return TMPFS_NONE;
+
+    struct tmpfs_node *node = &tmp.nodes[n];
+    tmp.free_node = node->next_sibling;
+
+    mem_set(node, 0, sizeof(struct tmpfs_node));
+    node->type = type;
+    node->parent = dir;
+    node->first_child = TMPFS_NONE;
+    node->next_sibling = TMPFS_NONE;
+    node->first_page = TMPFS_NONE;
+    str_cpy(node->name, name);
+
+    // Append, so listings come out in creation order
+    uint16_t *link = &tmp.nodes[dir].first_child;
+    while (*link != TMPFS_NONE) link = &tmp.nodes[*link].next_sibling;
+    *link = n;
+
+    tmp.stats.nodes_used++;
+    return n;
+}
+
+// Helper: Unlink a node from its directory and put it back on the free list
+static void node_free(uint16_t n) {
+    struct tmpfs_node *node = &tmp.nodes[n];
+
+    uint16_t *link = &tmp.nodes[node->parent].first_child;
+    while (*link != n) link = &tmp.nodes[*link].next_sibling;
+    *link = node->next_sibling;
+
+    node->type = INODE_TYPE_FREE;
+    node->next_sibling = tmp.free_node;
+    tmp.free_node = n;
+    tmp.stats.nodes_used--;
+}
+
+// Helper: Page 'index' of a file's chain
+static uint16_t page_at(const struct tmpfs_node *node, uint32_t index) {
+    uint16_t page = node->first_page;
+    while (index-- > 0 && page != TMPFS_NONE) page = tmp.page_next[page];
+    return page;
+}
+
+// Helper: Give a file exactly 'count' pages. New pages are zeroed; if the
+// pool cannot cover the growth nothing changes.
+static bool resize_pages(struct tmpfs_node *node, uint32_t count) {
+    if (count > node->page_count) {
+        uint32_t need = count - node->page_count;
+        if (need > TMPFS_PAGES - tmp.stats.pages_used) return FALSE;
+
+        uint16_t *link = &node->first_page;
+        while (*link != TMPFS_NONE) link = &tmp.page_next[*link];
+
+        while (need-- > 0) {
+            uint16_t page = tmp.free_page;
+            tmp.free_page = tmp.page_next[page];
+            mem_set(page_data(page), 0, TMPFS_PAGE_SIZE);
+            tmp.page_next[page] = TMPFS_NONE;
+            *link = page;
+            link = &tmp.page_next[page];
+        }
+    } else if (count < node->page_count) {
+        uint16_t *link = &node->first_page;
+        for (uint32_t i = 0; i < count; i++) link = &tmp.page_next[*link];
+
+        // Splice the rest of the chain onto the free list
+        uint16_t first = *link;
+        uint16_t last = first;
+        while (tmp.page_next[last] != TMPFS_NONE) last = tmp.page_next[last];
+        tmp.page_next[last] = tmp.free_page;
+        tmp.free_page = first;
+        *link = TMPFS_NONE;
+    }
+
+    tmp.stats.pages_used += count;
+    tmp.stats.pages_used -= node->page_count;
+    node->page_count = count;
+    return TRUE;
+}
+
+// Helper: Set a file's size, keeping every byte past the end zero so a
+// later grow needs no clearing
+static bool set_size(struct tmpfs_node *node, uint32_t size) {
+    uint32_t pages = (size + TMPFS_PAGE_SIZE - 1) / TMPFS_PAGE_SIZE;
+    if (!resize_pages(node, pages)) return FALSE;
+
+    if (size < node->size && size % TMPFS_PAGE_SIZE != 0) {
+        uint8_t *data = page_data(page_at(node, size / TMPFS_PAGE_SIZE));
+        uint32_t end = node->size - (size - size % TMPFS_PAGE_SIZE);
+        if (end > TMPFS_PAGE_SIZE) end = TMPFS_PAGE_SIZE;
+        mem_set(data + size % TMPFS_PAGE_SIZE, 0, end - size % TMPFS_PAGE_SIZE);
+    }
+    node->size = size;
+    return TRUE;
+}
+
+// Helper: Entry 'name' in a directory
+static uint16_t lookup(uint16_t dir, const char *name) {
+    for (uint16_t n = tmp.nodes[dir].first_child; n != TMPFS_NONE; n = tmp.nodes[n].next_sibling) {
+        if (str_cmp(tmp.nodes[n].name, name) == 0) return n;
+    }
+    return TMPFS_NONE;
+}
+
+// Helper: Walk a path to the directory holding its last component, which
+// is copied to 'leaf' ("" when the path names a directory itself)
+static bool walk_parent(const char *path, uint16_t *dir, char *leaf) {
+    uint16_t cur = TMPFS_ROOT;
+    leaf[0] = '\0';
+
+    while (*path != '\0') {
+        while (*path == '/') path++;
+        if (*path == '\0') break;
+
+        // Cut out the next component
+        char name[FS_MAX_FILENAME];
+        uint32_t len = 0;
+        while (path[len] != '\0' && path[len] != '/') {
+            if (len == FS_MAX_FILENAME - 1) return FALSE;   // Name too long
+            name[len] = path[len];
+            len++;
+        }
+        name[len] = '\0';
+        path += len;
+
+        bool last = TRUE;
+        for (const char *p = path; *p != '\0'; p++) {
+            if (*p != '/') {
+                last = FALSE;
+                break;
+            }
+        }
+
+        if (str_cmp(name, ".") == 0) {
+            continue;
+        }
+        if (str_cmp(name, "..") == 0) {
+            cur = tmp.nodes[cur].parent;
+            continue;
+        }
+        if (last) {
+            str_cpy(leaf, name);
+            break;
+        }
+
+        uint16_t n = lookup(cur, name);
+        if (n == TMPFS_NONE || tmp.nodes[n].type != INODE_TYPE_DIR) {
+            return FALSE;
+        }
+        cur = n;
+    }
+
+    *dir = cur;
+    return TRUE;
+}
+
+// Helper: Resolve a whole path to a node
+static bool resolve(const char *path, uint16_t *node) {
+    char leaf[FS_MAX_FILENAME];
+    uint16_t dir;
+
+    if (!walk_parent(path, &dir, leaf)) return FALSE;
+    if (leaf[0] == '\0') {
+        *node = dir;
+        return TRUE;
+    }
+
+    *node = lookup(dir, leaf);
+    return *node != TMPFS_NONE;
+}
+
+// Helper: Add a new entry of 'type' named 'name' to a directory
+static bool make_at(uint32_t dir, const char *name, uint8_t type) {
+    struct tmpfs_node *parent = get_node(dir);
+    if (parent == NULL || parent->type != INODE_TYPE_DIR || str_len(name) >= FS_MAX_FILENAME ||
+        lookup(dir, name) != TMPFS_NONE) {
+        return FALSE;
+    }
+    return node_alloc(dir, name, type) != TMPFS_NONE;
+}
+
+// Helper: Add a new entry of 'type' at 'path'
+static bool make(const char *path, uint8_t type) {
+    char name[FS_MAX_FILENAME];
+    uint16_t dir;
+
+    if (!walk_parent(path, &dir, name) || name[0] == '\0') {
+        return FALSE;
+    }
+    return make_at(dir, name, type);
+}
+
+bool tmpfs_mkdir(const char *path) {
+    return make(path, INODE_TYPE_DIR);
+}
+
+bool tmpfs_create(const char *path) {
+    return make(path, INODE_TYPE_FILE);
+}
+
+bool tmpfs_exists(const char *path) {
+    uint16_t node;
+    return resolve(path, &node);
+}
+
+bool tmpfs_open(const char *path, uint32_t *node) {
+    uint16_t n;
+    if (!resolve(path, &n)) return FALSE;
+    *node = n;
+    return TRUE;
+}
+
+bool tmpfs_list_dir(const char *path) {
+    uint16_t dir;
+    if (!resolve(path, &dir) || tmp.nodes[dir].type != INODE_TYPE_DIR) {
+        return FALSE;
+    }
+
+    bool found_any = FALSE;
+    for (uint16_t n = tmp.nodes[dir].first_child; n != TMPFS_NONE; n = tmp.nodes[n].next_sibling) {
+        struct tmpfs_node *node = &tmp.nodes[n];
+        found_any = TRUE;
+
+        if (node->type == INODE_TYPE_DIR) {
+            vga_set_color(VGA_LIGHT_BLUE, VGA_BLACK);
+            vga_puts("  [DIR]  ");
+        } else {
+            vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+            vga_puts("  [FILE] ");
+        }
+        vga_puts(node->name);
+
+        if (node->type == INODE_TYPE_FILE) {
+            vga_puts(" (");
+            vga_put_dec(node->size);
+            vga_puts(" bytes)");
+        }
+        vga_putchar('\n');
+    }
+
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    if (!found_any) {
+        vga_puts("  (empty directory)\n");
+    }
+    return TRUE;
+}
+
+// Helper: Next entry of a directory from *cursor
+static bool read_dir_at(uint32_t dir, uint32_t *cursor, struct dir_entry *entry) {
+    struct tmpfs_node *node = get_node(dir);
+    if (node == NULL || node->type != INODE_TYPE_DIR) {
+        return FALSE;
+    }
+
+    // The cursor counts entries already returned
+    uint16_t n = node->first_child;
+    for (uint32_t i = 0; i < *cursor && n != TMPFS_NONE; i++) {
+        n = tmp.nodes[n].next_sibling;
+    }
+    if (n == TMPFS_NONE) return FALSE;
+
+    mem_set(entry, 0, sizeof(struct dir_entry));
+    entry->inode = n;
+    entry->parent_inode = dir;
+    entry->type = tmp.nodes[n].type;
+    entry->name_len = str_len(tmp.nodes[n].name);
+    str_cpy(entry->name, tmp.nodes[n].name);
+    (*cursor)++;
+    return TRUE;
+}
+
+bool tmpfs_read_dir(const char *path, uint32_t *cursor, struct dir_entry *entry) {
+    uint16_t dir;
+    return resolve(path, &dir) && read_dir_at(dir, cursor, entry);
+}
+
+bool tmpfs_read(uint32_t node, void *buf, uint32_t *size) {
+    struct tmpfs_node *file = get_node(node);
+    if (file == NULL || file->type != INODE_TYPE_FILE) {
+        return FALSE;
+    }
+
+    *size = file->size;
+    return tmpfs_pread(node, buf, file->size, 0) == (int32_t)file->size;
+}
+
+bool tmpfs_write(uint32_t node, const void *buf, uint32_t size) {
+    struct tmpfs_node *file = get_node(node);
+    if (file == NULL || file->type != INODE_TYPE_FILE || size > 0x7FFFFFFF) {
+        return FALSE;
+    }
+
+    // Drop the old contents first so their pages can be reused
+    if (!set_size(file, 0) || !set_size(file, size)) {
+        return FALSE;
+    }
+    return tmpfs_pwrite(node, buf, size, 0) == (int32_t)size;
+}
+
+int32_t tmpfs_pread(uint32_t node, void *buf, uint32_t len, uint32_t offset) {
+    struct tmpfs_node *file = get_node(node);
+    if (file == NULL || file->type != INODE_TYPE_FILE) {
+        return -1;
+    }
+
+    if (offset >= file->size) return 0;
+    if (len > file->size - offset) len = file->size - offset;
+    if (len > 0x7FFFFFFF) len = 0x7FFFFFFF;
+
+    // Find the first page once, then follow the chain
+    uint8_t *dst = buf;
+    uint16_t page = page_at(file, offset / TMPFS_PAGE_SIZE);
+    uint32_t within = offset % TMPFS_PAGE_SIZE;
+    uint32_t left = len;
+
+    while (left > 0) {
+        uint32_t n = TMPFS_PAGE_SIZE - within;
+        if (n > left) n = left;
+
+        mem_cpy(dst, page_data(page) + within, n);
+        dst += n;
+        left -= n;
+        within = 0;
+        page = tmp.page_next[page];
+    }
+    return (int32_t)len;
+}
+
+int32_t tmpfs_pwrite(uint32_t node, const void *buf, uint32_t len, uint32_t offset) {
+    struct tmpfs_node *file = get_node(node);
+    if (file == NULL || file->type != INODE_TYPE_FILE) {
+        return -1;
+    }
+
+    uint32_t end = offset + len;
+    if (end < offset || end > 0x7FFFFFFF) return -1;
+    if (len == 0) return 0;
+
+    // Bytes between the old end and the write are already zero
+    if (end > file->size && !set_size(file, end)) {
+        return -1;
+    }
+
+    const uint8_t *src = buf;
+    uint16_t page = page_at(file, offset / TMPFS_PAGE_SIZE);
+    uint32_t within = offset % TMPFS_PAGE_SIZE;
+    uint32_t left = len;
+
+    while (left > 0) {
+        uint32_t n = TMPFS_PAGE_SIZE - within;
+        if (n > left) n = left;
+
+        mem_cpy(page_data(page) + within, src, n);
+        src += n;
+        left -= n;
+        within = 0;
+        page = tmp.page_next[page];
+    }
+    return (int32_t)len;
+}
+
+bool tmpfs_truncate(uint32_t node, uint32_t size) {
+    struct tmpfs_node *file = get_node(node);
+    if (file == NULL || file->type != INODE_TYPE_FILE || size > 0x7FFFFFFF) {
+        return FALSE;
+    }
+    return set_size(file, size);
+}
+
+// Helper: Remove entry 'name' from a directory, freeing its pages
+static bool remove_at(uint32_t dir, const char *name) {
+    struct tmpfs_node *parent = get_node(dir);
+    if (parent == NULL || parent->type != INODE_TYPE_DIR) {
+        return FALSE;
+    }
+
+    uint16_t n = lookup(dir, name);
+    if (n == TMPFS_NONE) {
+        return FALSE;
+    }
+
+    struct tmpfs_node *node = &tmp.nodes[n];
+    if (node->type == INODE_TYPE_DIR && node->first_child != TMPFS_NONE) {
+        return FALSE;  // Directory not empty
+    }
+
+    resize_pages(node, 0);
+    node_free(n);
+    return TRUE;
+}
+
+bool tmpfs_delete(const char *path) {
+    char name[FS_MAX_FILENAME];
+    uint16_t dir;
+
+    if (!walk_parent(path, &dir, name) || name[0] == '\0') {
+        return FALSE;
+    }
+    return remove_at(dir, name);
+}
+
+bool tmpfs_get_node(uint32_t node, struct tmpfs_node *out) {
+    struct tmpfs_node *n = get_node(node);
+    if (n == NULL) return FALSE;
+
+    mem_cpy(out, n, sizeof(struct tmpfs_node));
+    return TRUE;
+}
+
+void tmpfs_get_stats(struct tmpfs_stats *stats) {
+    mem_cpy(stats, &tmp.stats, sizeof(struct tmpfs_stats));
+}
+
+// VFS operations: nodes are node numbers
+static uint32_t vn_root(void) {
+    return TMPFS_ROOT;
+}
+
+static bool vn_lookup(uint32_t dir, const char *name, uint32_t *node, uint8_t *type) {
+    struct tmpfs_node *parent = get_node(dir);
+    if (parent == NULL || parent->type != INODE_TYPE_DIR) {
+        return FALSE;
+    }
+
+    uint16_t n = lookup(dir, name);
+    if (n == TMPFS_NONE) return FALSE;
+
+    *node = n;
+    *type = tmp.nodes[n].type;
+    return TRUE;
+}
+
+static bool vn_getattr(uint32_t node, struct vnode_attr *attr) {
+    struct tmpfs_node *n = get_node(node);
+    if (n == NULL) return FALSE;
+
+    attr->type = n->type;
+    attr->flags = 0;
+    attr->size = n->size;
+    return TRUE;
+}
+
+static bool vn_sync(void) {
+    return TRUE;    // Nothing is ever written back
+}
+
+const struct vnode_ops tmpfs_vnode_ops = {
+    .name           = "tmpfs",
+    .root           = vn_root,
+    .lookup         = vn_lookup,
+    .create         = make_at,
+    .remove         = remove_at,
+    .read_dir       = read_dir_at,
+    .read           = tmpfs_pread,
+    .write          = tmpfs_pwrite,
+    .truncate       = tmpfs_truncate,
+    .getattr        = vn_getattr,
+    .set_compressed = NULL,
+    .sync           = vn_sync,
+};
@@ -0,0 +1,438 @@
+#include "vfs.h"
+#include "vga.h"
+#include "string.h"
+
+static struct vfs_state vfs;
+
+void vfs_init(void) {
+    mem_set(&vfs, 0, sizeof(vfs));
+    str_cpy(vfs.cwd, "/");
+}
+
+// Helper: Join a path onto the working directory and resolve "." and "..",
+// giving "/" or "/a/b" with no trailing slash
+static bool normalize(const char *path, char *out) {
+    uint32_t len = 0;
+
+    if (*path != '/') {
+        str_cpy(out, vfs.cwd);
+        len = str_len(out);
+        if (len == 1) len = 0;  // The root adds nothing before a component
+    }
+
+    while (*path != '\0') {
+        while (*path == '/') path++;
+        if (*path == '\0') break;
+
+        uint32_t n = 0;
+        while (path[n] != '\0' && path[n] != '/') n++;
+        if (n >= FS_MAX_FILENAME) return FALSE;     // Name too long
+
+        if (n == 2 && path[0] == '.' && path[1] == '.') {
+            // Drop the last component; the root is its own parent
+            while (len > 0 && out[len - 1] != '/') len--;
+            if (len > 0) len--;
+        } else if (n != 1 || path[0] != '.') {
+            if (len + 1 + n >= FS_MAX_PATH) return FALSE;
+            out[len++] = '/';
+            mem_cpy(out + len, path, n);
+            len += n;
+        }
+        path += n;
+    }
+
+    if (len == 0) out[len++] = '/';
+    out[len] = '\0';
+    return TRUE;
+}
+
+// Helper: Split a normalized path into its parent and last component.
+// FALSE for the root, which has neither.
+static bool split(const char *path, char *parent, char *leaf) {
+    const char *slash = str_rchr(path, '/');
+    if (slash[1] == '\0') return FALSE;
+
+    str_cpy(leaf, slash + 1);
+    uint32_t len = slash - path;
+    if (len == 0) len = 1;      // Keep the root's slash
+    mem_cpy(parent, path, len);
+    parent[len] = '\0';
+    return TRUE;
+}
+
+// Helper: Check whether a normalized path is 'dir' or lies below it
+static bool is_within(const char *path, const char *dir) {
+    uint32_t len = str_len(dir);
+    if (len == 1) return TRUE;  // Everything is below the root
+    return str_ncmp(path, dir, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
+
+// Helper: Mount at exactly the first 'len' characters of a normalized path
+static struct vfs_mount *mount_at(const char *path, uint32_t len) {
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        struct vfs_mount *m = &vfs.mounts[i];
+        if (m->used && str_len(m->path) == len && str_ncmp(m->path, path, len) == 0) {
+            return m;
+        }
+    }
+    return NULL;
+}
+
+// Helper: Reference the vnode for a node, sharing one that already exists.
+// Otherwise a free slot is used, or the next unreferenced one is recycled.
+static struct vnode *vnode_get(struct vfs_mount *mnt, uint32_t node, uint8_t type) {
+    for (uint32_t i = 0; i < VFS_MAX_VNODES; i++) {
+        struct vnode *vn = &vfs.vnodes[i];
+        if (vn->mnt == mnt && vn->node == node) {
+            vn->type = type;    // A number can be reused by a new node
+            vn->refs++;
+            return vn;
+        }
+    }
+
+    for (uint32_t i = 0; i < VFS_MAX_VNODES; i++) {
+        struct vnode *vn = &vfs.vnodes[vfs.vnode_hand];
+        vfs.vnode_hand = (vfs.vnode_hand + 1) % VFS_MAX_VNODES;
+
+        if (vn->mnt == NULL || vn->refs == 0) {
+            vn->mnt = mnt;
+            vn->node = node;
+            vn->type = type;
+            vn->refs = 1;
+            return vn;
+        }
+    }
+    return NULL;    // Every vnode is in use
+}
+
+static void vnode_put(struct vnode *vn) {
+    if (vn != NULL && vn->refs > 0) vn->refs--;
+}
+
+// Helper: Forget the cached vnode of a node that no longer exists
+static void vnode_drop(struct vfs_mount *mnt, uint32_t node) {
+    for (uint32_t i = 0; i < VFS_MAX_VNODES; i++) {
+        struct vnode *vn = &vfs.vnodes[i];
+        if (vn->mnt == mnt && vn->node == node && vn->refs == 0) {
+            vn->mnt = NULL;
+        }
+    }
+}
+
+// Helper: Check whether a node is referenced
+static bool vnode_busy(struct vfs_mount *mnt, uint32_t node) {
+    for (uint32_t i = 0; i < VFS_MAX_VNODES; i++) {
+        struct vnode *vn = &vfs.vnodes[i];
+        if (vn->mnt == mnt && vn->node == node && vn->refs > 0) return TRUE;
+    }
+    return FALSE;
+}
+
+// Helper: Walk a normalized path one component at a time, stepping into
+// the root of any filesystem mounted along the way. Returns a referenced
+// vnode, NULL if the path does not exist.
+static struct vnode *walk(const char *path) {
+    struct vfs_mount *mnt = mount_at(path, 1);
+    if (mnt == NULL) return NULL;
+
+    struct vnode *cur = vnode_get(mnt, mnt->ops->root(), INODE_TYPE_DIR);
+    uint32_t pos = 1;
+
+    while (cur != NULL && path[pos] != '\0') {
+        if (path[pos] == '/') pos++;
+
+        char name[FS_MAX_FILENAME];
+        uint32_t end = pos;
+        while (path[end] != '\0' && path[end] != '/') end++;
+        mem_cpy(name, path + pos, end - pos);
+        name[end - pos] = '\0';
+
+        // A mount hides whatever the directory holds under that name
+        struct vfs_mount *next = mount_at(path, end);
+        uint32_t node;
+        uint8_t type = INODE_TYPE_DIR;
+
+        if (next != NULL) {
+            node = next->ops->root();
+        } else if (cur->type == INODE_TYPE_DIR &&
+                   cur->mnt->ops->lookup(cur->node, name, &node, &type)) {
+            next = cur->mnt;
+        }
+
+        // Let go of the directory first, so its slot can be reused
+        vnode_put(cur);
+        cur = next != NULL ? vnode_get(next, node, type) : NULL;
+        pos = end;
+    }
+    return cur;
+}
+
+// Helper: Resolve a path to its parent directory's vnode and last component
+static struct vnode *walk_parent(const char *path, char *full, char *leaf) {
+    char parent[FS_MAX_PATH];
+    if (!normalize(path, full) || !split(full, parent, leaf)) {
+        return NULL;
+    }
+
+    struct vnode *dir = walk(parent);
+    if (dir != NULL && dir->type != INODE_TYPE_DIR) {
+        vnode_put(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+bool vfs_mount(const char *path, const struct vnode_ops *ops) {
+    char full[FS_MAX_PATH];
+    if (!normalize(path, full) || mount_at(full, str_len(full)) != NULL) {
+        return FALSE;
+    }
+
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        struct vfs_mount *m = &vfs.mounts[i];
+        if (!m->used) {
+            m->used = TRUE;
+            str_cpy(m->path, full);
+            m->ops = ops;
+            return TRUE;
+        }
+    }
+    return FALSE;   // Mount table full
+}
+
+bool vfs_unmount(const char *path) {
+    char full[FS_MAX_PATH];
+    if (!normalize(path, full)) return FALSE;
+
+    struct vfs_mount *m = mount_at(full, str_len(full));
+    if (m == NULL || is_within(vfs.cwd, m->path)) {
+        return FALSE;
+    }
+
+    for (uint32_t i = 0; i < VFS_MAX_VNODES; i++) {
+        if (vfs.vnodes[i].mnt == m && vfs.vnodes[i].refs > 0) return FALSE;
+    }
+
+    // Write back what it has, then drop its cached vnodes
+    if (!m->ops->sync()) return FALSE;
+    for (uint32_t i = 0; i < VFS_MAX_VNODES; i++) {
+        if (vfs.vnodes[i].mnt == m) vfs.vnodes[i].mnt = NULL;
+    }
+    m->used = FALSE;
+    return TRUE;
+}
+
+const struct vfs_mount *vfs_get_mount(uint32_t index) {
+    if (index >= VFS_MAX_MOUNTS || !vfs.mounts[index].used) {
+        return NULL;
+    }
+    return &vfs.mounts[index];
+}
+
+const char* vfs_get_cwd(void) {
+    return vfs.cwd;
+}
+
+bool vfs_chdir(const char *path) {
+    char full[FS_MAX_PATH];
+    if (!normalize(path, full)) return FALSE;
+
+    struct vnode *dir = walk(full);
+    if (dir == NULL || dir->type != INODE_TYPE_DIR) {
+        vnode_put(dir);
+        return FALSE;  // Missing or not a directory
+    }
+    vnode_put(dir);
+
+    str_cpy(vfs.cwd, full);
+    return TRUE;
+}
+
+// Helper: Create an entry of 'type' at 'path'
+static bool make(const char *path, uint8_t type) {
+    char full[FS_MAX_PATH];
+    char name[FS_MAX_FILENAME];
+
+    struct vnode *dir = walk_parent(path, full, name);
+    if (dir == NULL) return FALSE;
+
+    // A mount point's name is taken even with nothing underneath it
+    bool ok = mount_at(full, str_len(full)) == NULL &&
+              dir->mnt->ops->create(dir->node, name, type);
+    vnode_put(dir);
+    return ok;
+}
+
+bool vfs_mkdir(const char *path) {
+    return make(path, INODE_TYPE_DIR);
+}
+
+bool vfs_create(const char *path) {
+    return make(path, INODE_TYPE_FILE);
+}
+
+bool vfs_exists(const char *path) {
+    struct vnode *vn = vfs_open(path);
+    vfs_close(vn);
+    return vn != NULL;
+}
+
+bool vfs_remove(const char *path) {
+    char full[FS_MAX_PATH];
+    char name[FS_MAX_FILENAME];
+
+    struct vnode *dir = walk_parent(path, full, name);
+    if (dir == NULL) return FALSE;
+
+    // Refuse for the working directory and anything holding it or a mount
+    bool ok = !is_within(vfs.cwd, full);
+    for (uint32_t i = 0; ok && i < VFS_MAX_MOUNTS; i++) {
+        if (vfs.mounts[i].used && is_within(vfs.mounts[i].path, full)) ok = FALSE;
+    }
+
+    // ...and for a node that is still open
+    uint32_t node;
+    uint8_t type;
+    const struct vnode_ops *ops = dir->mnt->ops;
+    if (ok) {
+        ok = ops->lookup(dir->node, name, &node, &type) && !vnode_busy(dir->mnt, node) &&
+             ops->remove(dir->node, name);
+    }
+    if (ok) vnode_drop(dir->mnt, node);
+
+    vnode_put(dir);
+    return ok;
+}
+
+bool vfs_stat(const char *path, struct vnode_attr *attr) {
+    struct vnode *vn = vfs_open(path);
+    if (vn == NULL) return FALSE;
+
+    bool ok = vfs_getattr(vn, attr);
+    vfs_close(vn);
+    return ok;
+}
+
+// Helper: Print one directory entry the way fs_list_dir does
+static void list_entry(struct vnode *dir, const char *name, uint8_t type, uint32_t node) {
+    if (type == INODE_TYPE_DIR) {
+        vga_set_color(VGA_LIGHT_BLUE, VGA_BLACK);
+        vga_puts("  [DIR]  ");
+    } else {
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+        vga_puts("  [FILE] ");
+    }
+    vga_puts(name);
+
+    // Show file size for files
+    struct vnode_attr attr;
+    if (type == INODE_TYPE_FILE && dir->mnt->ops->getattr(node, &attr)) {
+        vga_puts(" (");
+        vga_put_dec(attr.size);
+        vga_puts(attr.flags & INODE_FLAG_COMPRESSED ? " bytes, compressed)" : " bytes)");
+    }
+    vga_putchar('\n');
+}
+
+bool vfs_list_dir(const char *path) {
+    char full[FS_MAX_PATH];
+    if (!normalize(path != NULL ? path : ".", full)) return FALSE;
+
+    struct vnode *dir = walk(full);
+    if (dir == NULL || dir->type != INODE_TYPE_DIR) {
+        vnode_put(dir);
+        return FALSE;
+    }
+
+    const struct vnode_ops *ops = dir->mnt->ops;
+    bool found_any = FALSE;
+    uint32_t cursor = 0;
+    struct dir_entry e;
+
+    while (ops->read_dir(dir->node, &cursor, &e)) {
+        found_any = TRUE;
+        list_entry(dir, e.name, e.type, e.inode);
+    }
+
+    // Mount points directly inside, unless the directory has them already
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        struct vfs_mount *m = &vfs.mounts[i];
+        char parent[FS_MAX_PATH];
+        char name[FS_MAX_FILENAME];
+        uint32_t node;
+        uint8_t type;
+
+        if (m->used && split(m->path, parent, name) && str_cmp(parent, full) == 0 &&
+            !ops->lookup(dir->node, name, &node, &type)) {
+            found_any = TRUE;
+            list_entry(dir, name, INODE_TYPE_DIR, 0);
+        }
+    }
+
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    if (!found_any) {
+        vga_puts("  (empty directory)\n");
+    }
+
+    vnode_put(dir);
+    return TRUE;
+}
+
+bool vfs_read_dir(const char *path, uint32_t *cursor, struct dir_entry *entry) {
+    struct vnode *dir = vfs_open(path);
+    if (dir == NULL) return FALSE;
+
+    bool ok = dir->type == INODE_TYPE_DIR && dir->mnt->ops->read_dir(dir->node, cursor, entry);
+    vfs_close(dir);
+    return ok;
+}
+
+bool vfs_set_compressed(const char *path, bool on) {
+    struct vnode *vn = vfs_open(path);
+    if (vn == NULL) return FALSE;
+
+    const struct vnode_ops *ops = vn->mnt->ops;
+    bool ok = ops->set_compressed != NULL && ops->set_compressed(vn->node, on);
+    vfs_close(vn);
+    return ok;
+}
+
+bool vfs_sync(void) {
+    bool ok = TRUE;
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (vfs.mounts[i].used && !vfs.mounts[i].ops->sync()) ok = FALSE;
+    }
+    return ok;
+}
+
+struct vnode *vfs_open(const char *path) {
+    char full[FS_MAX_PATH];
+    if (!normalize(path, full)) return NULL;
+    return walk(full);
+}
+
+void vfs_close(struct vnode *vn) {
+    vnode_put(vn);
+}
+
+int32_t vfs_read(struct vnode *vn, void *buf, uint32_t len, uint32_t offset) {
+    if (vn->type != INODE_TYPE_FILE) return -1;
+    return vn->mnt->ops->read(vn->node, buf, len, offset);
+}
+
+int32_t vfs_write(struct vnode *vn, const void *buf, uint32_t len, uint32_t offset) {
+    if (vn->type != INODE_TYPE_FILE) return -1;
+    return vn->mnt->ops->write(vn->node, buf, len, offset);
+}
+
+bool vfs_truncate(struct vnode *vn, uint32_t size) {
+    return vn->type == INODE_TYPE_FILE && vn->mnt->ops->truncate(vn->node, size);
+}
+
+bool vfs_getattr(struct vnode *vn, struct vnode_attr *attr) {
+    return vn->mnt->ops->getattr(vn->node, attr);
+}
+
+bool vfs_fsync(struct vnode *vn) {
+    return vn->mnt->ops->sync();
+}
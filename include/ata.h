@@ -17,6 +17,26 @@
 #define ATA_PRIMARY_CONTROL     0x3F6   // Control register
 #define ATA_PRIMARY_ALTSTATUS   0x3F6   // Alternate status (R)
 
+// ATA I/O ports (Secondary controller)
+#define ATA_SECONDARY_IO        0x170   // Base of the task-file registers
+#define ATA_SECONDARY_CONTROL   0x376   // Control / alternate status
+
+// Task-file register offsets from a channel's I/O base
+#define ATA_REG_DATA            0
+#define ATA_REG_ERROR           1
+#define ATA_REG_FEATURES        1
+#define ATA_REG_SECCOUNT        2
+#define ATA_REG_LBA_LO          3
+#define ATA_REG_LBA_MID         4
+#define ATA_REG_LBA_HI          5
+#define ATA_REG_DRIVE           6
+#define ATA_REG_STATUS          7
+#define ATA_REG_COMMAND         7
+
+// Channels and drives (drive = channel * 2 + slave)
+#define ATA_CHANNELS            2
+#define ATA_MAX_DRIVES          4
+
 // Status register bits
 #define ATA_STATUS_ERR          0x01    // Error occurred
 #define ATA_STATUS_IDX          0x02    // Index mark
@@ -32,32 +52,120 @@
 #define ATA_CMD_READ_PIO_EXT    0x24    // Read sectors ext (LBA48)
 #define ATA_CMD_WRITE_PIO       0x30    // Write sectors (PIO)
 #define ATA_CMD_WRITE_PIO_EXT   0x34    // Write sectors ext (LBA48)
+#define ATA_CMD_READ_DMA        0xC8    // Read sectors (DMA)
+#define ATA_CMD_READ_DMA_EXT    0x25    // Read sectors ext (DMA, LBA48)
+#define ATA_CMD_WRITE_DMA       0xCA    // Write sectors (DMA)
+#define ATA_CMD_WRITE_DMA_EXT   0x35    // Write sectors ext (DMA, LBA48)
 #define ATA_CMD_CACHE_FLUSH     0xE7    // Flush write cache
 #define ATA_CMD_CACHE_FLUSH_EXT 0xEA    // Flush write cache ext
 #define ATA_CMD_IDENTIFY        0xEC    // Identify drive
 
+// Bus-master IDE registers (offsets from BAR4, primary channel)
+#define ATA_BM_SECONDARY        0x08    // Secondary channel block follows
+#define ATA_BM_COMMAND          0x00    // Command register
+#define ATA_BM_STATUS           0x02    // Status register
+#define ATA_BM_PRDT             0x04    // PRD table physical address
+
+// Bus-master command bits
+#define ATA_BM_CMD_START        0x01    // Start/stop bus master
+#define ATA_BM_CMD_READ         0x08    // Direction: device -> memory
+
+// Bus-master status bits
+#define ATA_BM_STATUS_ACTIVE    0x01    // Transfer in progress
+#define ATA_BM_STATUS_ERR       0x02    // DMA error (write 1 to clear)
+#define ATA_BM_STATUS_IRQ       0x04    // Interrupt raised (write 1 to clear)
+
+// Physical region descriptor (one per buffer fragment, max 64 KiB)
+#define ATA_PRD_EOT             0x8000  // Last entry in table
+#define ATA_PRD_ENTRIES         32
+#define ATA_DMA_MAX_SECTORS     2048    // 1 MiB per DMA command fits the PRD table
+
+struct ata_prd {
+    uint32_t phys_addr;         // Buffer address (word aligned)
+    uint16_t byte_count;        // 0 means 64 KiB
+    uint16_t flags;             // ATA_PRD_EOT on last entry
+} __attribute__((packed));
+
 // Drive selection
 #define ATA_DRIVE_MASTER        0xE0    // Master drive (with LBA)
 #define ATA_DRIVE_SLAVE         0xF0    // Slave drive (with LBA)
+#define ATA_DRIVE_LBA48_MASTER  0x40    // Master drive (LBA48 addressing)
+#define ATA_DRIVE_LBA48_SLAVE   0x50    // Slave drive (LBA48 addressing)
 
 // Sector size
 #define ATA_SECTOR_SIZE         512
 
+// Addressing limits
+#define ATA_LBA28_LIMIT         0x10000000  // First sector beyond 28-bit LBA (128 GiB)
+#define ATA_MAX_SECTORS_LBA28   256     // Per command (count 0 = 256)
+#define ATA_MAX_SECTORS_LBA48   65536   // Per command (count 0 = 65536)
+
+// Upper bound on any single wait (BSY, DRQ or completion interrupt)
+#define ATA_TIMEOUT_MS          5000
+#define ATA_SPIN_LIMIT          1000000 // Polls allowed where ticks cannot advance (IRQ context)
+
+// Request types
+#define ATA_REQ_READ            0
+#define ATA_REQ_WRITE           1
+#define ATA_REQ_FLUSH           2       // Barrier: runs after every older request
+
+// Request states
+#define ATA_REQ_PENDING         0       // Queued, not yet started
+#define ATA_REQ_ACTIVE          1       // Part of the command in flight
+#define ATA_REQ_DONE            2       // Completed successfully
+#define ATA_REQ_ERROR           3       // Failed or timed out
+
+// Requests merged into one command (one PRD run or PIO segment each)
+#define ATA_MAX_SEGMENTS        16
+
+struct ata_request;
+typedef void (*ata_callback_t)(struct ata_request *req);
+
+// Asynchronous I/O request. The memory belongs to the caller and must stay
+// valid until the request completes.
+struct ata_request {
+    // Filled in by the caller
+    uint8_t  type;              // ATA_REQ_*
+    uint8_t  drive;             // 0-3
+    uint64_t lba;
+    uint32_t count;             // Sectors (ignored for flush)
+    void    *buffer;
+    ata_callback_t callback;    // Runs in IRQ context on completion (may be NULL)
+    void    *context;           // For the caller's use
+
+    // Owned by the driver while queued
+    volatile uint8_t status;    // ATA_REQ_*
+    uint32_t done;              // Sectors transferred so far
+    struct ata_request *next;   // Channel queue link (submission order)
+};
+
 // Drive info
 struct ata_drive {
     bool     present;           // Drive detected
     bool     is_atapi;          // ATAPI (CD-ROM) vs ATA
-    uint8_t  drive_num;         // 0 = master, 1 = slave
-    uint32_t size_sectors;      // Size in sectors
+    bool     dma;               // Supports multiword/UDMA transfers
+    bool     lba48;             // Supports 48-bit addressing
+    uint8_t  drive_num;         // 0/1 = primary master/slave, 2/3 = secondary
+    uint64_t size_sectors;      // Size in sectors
     char     model[41];         // Model string (null-terminated)
 };
 
 // Function prototypes
 void ata_init(void);
 bool ata_identify(uint8_t drive, struct ata_drive *info);
-bool ata_read_sectors(uint8_t drive, uint32_t lba, uint8_t count, void *buffer);
-bool ata_write_sectors(uint8_t drive, uint32_t lba, uint8_t count, const void *buffer);
-void ata_soft_reset(void);
+bool ata_read_sectors(uint8_t drive, uint64_t lba, uint32_t count, void *buffer);
+bool ata_write_sectors(uint8_t drive, uint64_t lba, uint32_t count, const void *buffer);
+bool ata_flush(uint8_t drive);     // Writes are cached by the drive until flushed
+void ata_soft_reset(uint8_t channel);
+void ata_irq_handler(uint8_t channel);
+
+// Asynchronous interface: queue a request, optionally sleep until it completes
+bool ata_submit(struct ata_request *req);
+bool ata_wait(struct ata_request *req);
+
+// Queue a batch of requests with the channel held, then let it go as merged commands
+void ata_plug(uint8_t drive);
+void ata_unplug(uint8_t drive);
 
 // Get drive info
 struct ata_drive* ata_get_drive(uint8_t drive);
@@ -0,0 +1,71 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "types.h"
+#include "ata.h"
+
+// Block cache geometry
+#define BCACHE_BLOCK_SIZE   512     // One ATA sector per buffer
+#define BCACHE_BUFFERS      64      // Fixed buffer pool
+#define BCACHE_HASH_SIZE    64      // Hash buckets (power of two)
+#define BCACHE_STAGE_BLOCKS 16      // Max sectors coalesced per write-back command
+
+#define BCACHE_NONE         (-1)    // Null link in hash/LRU lists
+
+// A cached sector
+struct bcache_buf {
+    uint32_t lba;
+    uint8_t  drive;
+    bool     valid;                 // Holds a copy of lba
+    bool     dirty;                 // Newer than the disk copy
+    bool     loading;               // Asynchronous read (readahead) outstanding
+    bool     pinned;                // Uncommitted journal data: never written back
+    int16_t  hash_next;             // Next buffer in the same bucket
+    int16_t  lru_prev;              // Towards most recently used
+    int16_t  lru_next;              // Towards least recently used
+    struct ata_request req;         // Readahead request filling 'data'
+    uint8_t  data[BCACHE_BLOCK_SIZE];
+};
+
+// Counters since boot
+struct bcache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;            // Sectors written back to disk
+    uint32_t prefetches;            // Sectors queued by readahead
+};
+
+// Block cache functions
+void bcache_init(void);
+bool bcache_read(uint8_t drive, uint32_t lba, void *buf);
+bool bcache_write(uint8_t drive, uint32_t lba, const void *buf);
+bool bcache_sync(void);
+
+// Readahead: queue asynchronous reads of uncached sectors into the cache.
+// The requests are queued with the drive plugged, so the driver merges each
+// contiguous run into one command instead of sending its first sector alone.
+// Returns how many of the sectors are cached or on their way; fewer than
+// count means no buffer could be spared for the rest.
+uint32_t bcache_prefetch(uint8_t drive, uint32_t lba, uint32_t count);
+
+// Copy a sector out only if it is cached (waits for a pending readahead).
+// Meant for streaming reads: the buffer becomes the first to be reused.
+bool bcache_read_cached(uint8_t drive, uint32_t lba, void *buf);
+bool bcache_contains(uint8_t drive, uint32_t lba);
+
+// Journal support: a pinned buffer stays cached and is skipped by write-back
+// until unpinned (FALSE if the sector is not cached)
+bool bcache_pin(uint8_t drive, uint32_t lba, bool pinned);
+
+// Keep the cache coherent with transfers that bypass it
+bool bcache_writeback_range(uint8_t drive, uint32_t lba, uint32_t count);
+void bcache_invalidate_range(uint8_t drive, uint32_t lba, uint32_t count);
+
+// Drop every buffer, dirty or pinned ones included, without writing anything
+// back (the disk is about to be reformatted)
+void bcache_reset(void);
+
+void bcache_get_stats(struct bcache_stats *stats);
+
+#endif
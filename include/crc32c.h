@@ -0,0 +1,15 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include "types.h"
+
+// CRC-32C (Castagnoli, reflected polynomial 0x82F63B78). Uses the SSE4.2
+// crc32 instruction when CPUID reports it, slice-by-8 tables otherwise.
+
+// Extend 'crc' (0 to start) over 'len' bytes
+uint32_t crc32c(uint32_t crc, const void *buf, uint32_t len);
+
+// Whether the instruction is in use (detected on the first call)
+bool crc32c_hardware(void);
+
+#endif
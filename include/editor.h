@@ -8,8 +8,7 @@
 #define EDITOR_VISIBLE_LINES 23  // Lines 0-22, status on 23-24
 
 struct editor_state {
-    char     filename[32];
-    uint32_t file_inode;
+    char     filename[64];    // Path as typed
     bool     is_new_file;
     bool     modified;
 
@@ -30,6 +29,7 @@ struct editor_state {
 
     // Running flag
     bool     running;
+    bool     load_failed;       // File could not be opened for editing
 };
 
 // Editor functions
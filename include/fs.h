@@ -5,27 +5,87 @@
 
 // Filesystem constants
 #define FS_MAGIC            0x4D4F4E4B  // "MONK"
-#define FS_VERSION          1
-#define FS_MAX_INODES       64
-#define FS_MAX_DIR_ENTRIES  256
+// On-disk format versions; older volumes are upgraded at mount.
+// v2: free-block bitmap
+// v3: extents
+// v4: clusters
+// v5: journal
+// v6: inline data
+// v7: directory blocks
+// v8: sized inode table
+// v9: compression
+// v10: checksums
+// v11: hashed directories
+#define FS_VERSION          11      // Format written by fs_format
+#define FS_MIN_INODES       64      // Inode table limits at format
+#define FS_MAX_INODES       1048576
+#define FS_BYTES_PER_INODE  16384   // Default inode density at format
+#define FS_INODE_NONE       0xFFFFFFFF  // No inode number
 #define FS_MAX_FILENAME     32
 #define FS_MAX_PATH         256
 #define FS_SECTOR_SIZE      512
-#define FS_DIRECT_BLOCKS    10
+#define FS_MIN_CLUSTER_SIZE 512     // Allocation unit limits, powers of two
+#define FS_MAX_CLUSTER_SIZE 65536
+#define FS_DEFAULT_CLUSTER_SIZE 512
+#define FS_DIRECT_BLOCKS    10      // Block pointers in a v1/v2 inode
+#define FS_INODE_EXTENTS    4       // Extents held in the inode itself
+#define FS_INDIRECT_EXTENTS 64      // Extents in the indirect sector
+#define FS_MAX_EXTENTS      (FS_INODE_EXTENTS + FS_INDIRECT_EXTENTS)
+#define FS_INLINE_SIZE      44      // File bytes kept in the inode in place of its extents
+#define FS_CHUNK_SIZE       4096    // Compression unit
+#define FS_CHUNK_SECTORS    (FS_CHUNK_SIZE / FS_SECTOR_SIZE)
+#define FS_MAX_CHUNKS       FS_SECTOR_SIZE  // One chunk map sector, a byte per chunk
+#define FS_COMPRESS_MAX_SIZE (FS_MAX_CHUNKS * FS_CHUNK_SIZE)   // Larger files are stored plain
 
 // Sector layout
 #define FS_SUPERBLOCK_SECTOR    0
-#define FS_INODE_START_SECTOR   1
-#define FS_INODE_SECTORS        8       // 64 inodes, 8 per sector
-#define FS_DIRENTRY_START       9
-#define FS_DIRENTRY_SECTORS     32      // 256 entries, 8 per sector
-#define FS_DATA_START_SECTOR    41
+#define FS_INODE_START_SECTOR   1       // Inode table, then inode bitmap, checksum table, cluster bitmap, data
+#define FS_INODES_PER_SECTOR    8
+#define FS_DIRENTRY_SECTORS     32      // Global entry table (v1-v6), moved into directories at upgrade
+#define FS_DEFAULT_SECTORS      20480   // Volume size when the drive reports none (10MB)
+#define FS_BITS_PER_SECTOR      (FS_SECTOR_SIZE * 8)
+#define FS_DIRENTS_PER_SECTOR   8
+#define FS_CSUMS_PER_SECTOR     (FS_SECTOR_SIZE / 4)
+
+// Cluster allocation
+#define FS_ALLOC_SCAN_RUNS      32      // Free runs looked at before settling for the largest
+
+// Metadata journal
+#define FS_JOURNAL_MAGIC        0x4A524E4C  // "JRNL"
+#define FS_JOURNAL_SECTORS      256     // Log size at format, including its header sector
+#define FS_JOURNAL_TXN_MAX      24      // Sectors per transaction (pinned in the block cache)
+#define FS_JOURNAL_STEP_SECTORS 16      // Sectors one step of an operation may log, checksum sectors included
+#define FS_JOURNAL_TXN_REVOKES  32      // Revoked sectors per transaction
+#define FS_JOURNAL_MAX_REVOKES  128     // Revoked sectors in the log between checkpoints
+
+// Directories
+#define FS_DIR_NONE         0xFFFFFFFF  // No entry index
+#define FS_DIR_REMOVED      0xFF        // Type of a removed entry's slot that lookups must go past (v11)
+#define FS_DIR_MAX_RUN      4           // Full sectors in a row before the table is rebuilt
+
+// Sequential readahead
+#define FS_RA_SLOTS         4       // Files tracked at once
+#define FS_RA_MIN_BLOCKS    4       // Window after a non-sequential access
+#define FS_RA_MAX_BLOCKS    32      // Window cap (half the block cache)
+
+// Dentry cache
+#define FS_DCACHE_SIZE      64      // Cached name lookups, including misses
+
+// Open file handles
+#define FS_MAX_OPEN_FILES   16
+#define FS_SEEK_SET         0       // fs_seek origins
+#define FS_SEEK_CUR         1
+#define FS_SEEK_END         2
 
 // Inode types
 #define INODE_TYPE_FREE     0
 #define INODE_TYPE_FILE     1
 #define INODE_TYPE_DIR      2
 
+// Inode flags
+#define INODE_FLAG_INLINE   0x01    // Data lives in the inode, no clusters (v6)
+#define INODE_FLAG_COMPRESSED 0x02  // File data in compressed chunks; a directory's new entries inherit it (v9)
+
 // Superblock structure (512 bytes)
 struct superblock {
     uint32_t magic;
@@ -33,17 +93,56 @@ struct superblock {
     uint32_t total_sectors;
     uint32_t inode_count;
     uint32_t inode_start;
-    uint32_t direntry_start;
+    uint32_t direntry_start;        // Global entry table (v1-v6, 0 from v7)
     uint32_t data_start;
     uint32_t free_inodes;           // Count of free inodes
-    uint32_t free_data_blocks;      // Count of free data blocks
+    uint32_t free_data_blocks;      // Count of free data clusters
     uint32_t root_inode;
-    uint32_t next_free_block;       // Next data block to allocate
-    uint8_t  reserved[468];
+    uint32_t next_free_block;       // Allocation cursor (v1: bump pointer)
+    uint32_t bitmap_start;          // First free-cluster bitmap sector
+    uint32_t bitmap_sectors;
+    uint32_t data_blocks;           // Clusters covered by the bitmap, from data_start
+    uint32_t cluster_sectors;       // Sectors per cluster (v4, 1 before)
+    uint32_t journal_start;         // Metadata journal region (v5, 0 = none)
+    uint32_t journal_sectors;
+    uint32_t inode_bitmap_start;    // Free-inode bitmap (v8, 0 before)
+    uint32_t inode_bitmap_sectors;
+    uint32_t csum_start;            // CRC32C of every sector, by LBA (v10, 0 = none)
+    uint32_t csum_sectors;
+    uint8_t  reserved[428];
+} __attribute__((packed));
+
+// Extent: a run of physically contiguous clusters
+struct fs_extent {
+    uint32_t start;                 // First LBA
+    uint32_t length;                // Clusters
 } __attribute__((packed));
 
 // Inode structure (64 bytes)
 struct inode {
+    uint8_t  type;
+    uint8_t  flags;                 // INODE_FLAG_* (v6, zero before)
+    uint16_t permissions;
+    uint32_t size;
+    union {
+        struct {
+            struct fs_extent extents[FS_INODE_EXTENTS];
+            uint32_t extent_count;  // Including extents in the indirect sector
+            uint32_t indirect;      // Sector holding extents past the first four (0 = none)
+            uint32_t block_count;   // Clusters allocated
+        } __attribute__((packed));
+        uint8_t inline_data[FS_INLINE_SIZE];    // With INODE_FLAG_INLINE
+    };
+    uint32_t parent_inode;
+    uint32_t created;
+    union {
+        uint32_t child_count;       // Entries in a directory (v7, zero before)
+        uint32_t chunk_map;         // Compressed file: sector of stored chunk sizes (v9, 0 = none)
+    };
+} __attribute__((packed));
+
+// Version 1/2 inode (64 bytes), converted to extents at mount
+struct inode_v2 {
     uint8_t  type;
     uint8_t  reserved;
     uint16_t permissions;
@@ -55,7 +154,11 @@ struct inode {
     uint8_t  padding[4];
 } __attribute__((packed));
 
-// Directory entry (64 bytes)
+// Directory entry (64 bytes). A directory's data is a hash table of these:
+// a power-of-two number of sectors, each entry in the sector its name
+// hashes to or, when that is full, one of the sectors after it. Free slots
+// have inode 0. Before v11 entries were kept in any order, and before v7
+// one global table held all.
 struct dir_entry {
     uint32_t inode;
     uint32_t parent_inode;
@@ -65,6 +168,60 @@ struct dir_entry {
     uint8_t  padding[22];
 } __attribute__((packed));
 
+// Per-file readahead state
+struct fs_readahead {
+    uint32_t inode;
+    uint32_t next_block;    // Block a sequential reader asks for next
+    uint32_t window;        // Blocks to prefetch beyond each read
+    uint32_t last_used;     // For slot replacement
+    bool     used;
+};
+
+// First sector of the journal region: where replay starts
+struct journal_super {
+    uint32_t magic;
+    uint32_t sequence;              // Transaction expected in the first log sector
+    uint8_t  reserved[504];
+} __attribute__((packed));
+
+// Transaction header (512 bytes), followed in the log by 'count' sectors.
+// Sectors revoked here are skipped in this and older transactions on replay.
+struct journal_header {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t count;                 // Logged sectors following the header
+    uint32_t revoke_count;
+    uint32_t checksum;              // FNV-1a over the header (this field zero) and logged sectors
+    uint32_t lbas[123];             // Home sectors of the logged sectors, then revoked sectors
+} __attribute__((packed));
+
+// Cached name lookup; inode 0 records that the name does not exist
+struct fs_dentry {
+    uint32_t parent_inode;
+    uint32_t hash;          // Hash of the name
+    uint32_t inode;
+    uint32_t index;         // Entry index in the directory (positive entries)
+    uint8_t  type;
+    bool     used;
+    uint32_t last_used;     // For replacement
+    char     name[FS_MAX_FILENAME];
+};
+
+// Open file handle
+struct fs_file {
+    uint32_t inode;
+    uint32_t offset;        // Position for fs_fread/fs_fwrite
+    bool     used;
+};
+
+// Checksum counters since boot
+struct fs_csum_stats {
+    uint32_t verified;      // Sectors read whose checksum matched
+    uint32_t unrecorded;    // Sectors read that were never written with checksums on
+    uint32_t mismatches;
+    uint32_t last_bad;      // Sector of the latest mismatch
+};
+
 // Filesystem state
 struct fs_state {
     struct superblock sb;
@@ -72,33 +229,112 @@ struct fs_state {
     char     cwd_path[FS_MAX_PATH];
     uint8_t  sector_buf[FS_SECTOR_SIZE];
     bool     mounted;
+    struct fs_readahead ra[FS_RA_SLOTS];
+    uint32_t ra_clock;
+    struct fs_file files[FS_MAX_OPEN_FILES];
+
+    // Inode sectors are read and patched through the block cache
+    uint8_t  inode_buf[FS_SECTOR_SIZE];
+
+    // One-sector window onto the inode bitmap (bit set = in use)
+    uint32_t imap_buf[FS_SECTOR_SIZE / 4];
+    int32_t  imap_sector;                               // Loaded bitmap sector, -1 if none
+    bool     imap_dirty;
+    uint32_t imap_hint;                                 // No free inode below this
+
+    // Dentry cache: path walks that hit it need no disk I/O
+    struct fs_dentry dcache[FS_DCACHE_SIZE];
+    uint32_t dcache_clock;
+
+    // One-sector window onto the free-block bitmap (bit set = in use)
+    uint32_t bmap_buf[FS_SECTOR_SIZE / 4];
+    int32_t  bmap_sector;                               // Loaded bitmap sector, -1 if none
+    bool     bmap_dirty;
+
+    // Last indirect extent sector used (written through on change)
+    struct fs_extent ext_buf[FS_INDIRECT_EXTENTS];
+    uint32_t ext_sector;                                // 0 if none
+
+    // Compressed files: each 4KB chunk sits in its own 8-sector slot, and the
+    // chunk map says how many of those sectors it fills (0 = all zeros,
+    // 8 = stored plain). The last chunk map used is written through on change.
+    uint8_t  cmap_buf[FS_SECTOR_SIZE];
+    uint32_t cmap_sector;                               // 0 if none
+    uint8_t  chunk_buf[FS_CHUNK_SIZE];                  // Last chunk used, decompressed
+    uint32_t chunk_map;                                 // Its file's chunk map, 0 if none
+    uint32_t chunk_index;
+    uint8_t  zbuf[FS_CHUNK_SIZE];                       // A chunk as stored
+
+    // Checksum table: a CRC32C per sector, 0 if none recorded. The last
+    // table sector used is written through on change.
+    bool     csum_active;
+    uint32_t csum_buf[FS_CSUMS_PER_SECTOR];
+    int32_t  csum_sector;                               // Loaded table sector, -1 if none
+    struct fs_csum_stats csum_stats;
+
+    // Metadata journal: the running transaction is pinned in the block cache
+    bool     journal_active;
+    uint32_t journal_head;                              // Next log sector (relative to the header)
+    uint32_t journal_seq;                               // Next transaction number
+    uint32_t journal_revokes;                           // Revokes logged since the last checkpoint
+    bool     data_dirty;                                // Data written since the last commit
+    uint32_t txn_lbas[FS_JOURNAL_TXN_MAX];
+    uint32_t txn_count;
+    uint32_t txn_revokes[FS_JOURNAL_TXN_REVOKES];
+    uint32_t txn_revoke_count;
 };
 
 // Filesystem functions
 void fs_init(void);
-bool fs_format(void);
+bool fs_format(uint32_t cluster_size, uint32_t inode_count);    // 0 for the defaults (inodes sized from the drive)
 bool fs_mount(void);
 bool fs_is_mounted(void);
+bool fs_sync(void);     // Flush pending writes to stable storage
 
-// Path operations
+// Path operations. Paths may be absolute or relative to the working
+// directory, with any number of components, "." and "..".
 const char* fs_get_cwd(void);
 uint32_t fs_get_cwd_inode(void);
 
 // Directory operations
-bool fs_mkdir(const char *name);
-bool fs_chdir(const char *name);
-bool fs_list_dir(void);
+bool fs_mkdir(const char *path);
+bool fs_chdir(const char *path);
+bool fs_list_dir(const char *path);     // NULL for the working directory
+bool fs_read_dir(const char *path, uint32_t *cursor, struct dir_entry *entry);  // Next entry from *cursor (start at 0), FALSE at the end
 
 // File operations
-bool fs_create(const char *name);
-bool fs_exists(const char *name);
-bool fs_open(const char *name, uint32_t *inode);
+bool fs_create(const char *path);
+bool fs_exists(const char *path);
+bool fs_open(const char *path, uint32_t *inode);
 bool fs_read(uint32_t inode, void *buf, uint32_t *size);
 bool fs_write(uint32_t inode, const void *buf, uint32_t size);
-bool fs_delete(const char *name);
+bool fs_delete(const char *path);
+
+// File handles: byte-granular access that only touches the sectors involved.
+// Writes are committed by fs_sync or when the handle is closed.
+int32_t fs_fopen(const char *path);     // Returns a handle, -1 on error
+bool    fs_fclose(int32_t fd);
+int32_t fs_pread(int32_t fd, void *buf, uint32_t len, uint32_t offset);
+int32_t fs_pwrite(int32_t fd, const void *buf, uint32_t len, uint32_t offset);
+int32_t fs_append(int32_t fd, const void *buf, uint32_t len);
+int32_t fs_fread(int32_t fd, void *buf, uint32_t len);         // At the handle position
+int32_t fs_fwrite(int32_t fd, const void *buf, uint32_t len);
+int32_t fs_seek(int32_t fd, int32_t offset, int whence);       // Returns the new position
+bool    fs_truncate(int32_t fd, uint32_t size);
+
+// Compression: a file's data is converted in place; a directory only
+// passes the setting on to entries created in it afterwards
+bool fs_set_compressed(const char *path, bool on);
+
+// Sector checksums verified and failed since boot
+void fs_get_csum_stats(struct fs_csum_stats *stats);
 
 // Get file/directory info
-bool fs_get_entry(const char *name, struct dir_entry *entry);
+bool fs_get_entry(const char *path, struct dir_entry *entry);
 bool fs_get_inode(uint32_t inode_num, struct inode *inode);
 
+// Operations for mounting in the VFS (vfs.h)
+struct vnode_ops;
+extern const struct vnode_ops fs_vnode_ops;
+
 #endif
@@ -15,6 +15,17 @@ extern void outw(uint16_t port, uint16_t data);
 extern void insw(uint16_t port, void *addr, uint32_t count);
 extern void outsw(uint16_t port, const void *addr, uint32_t count);
 
+// Double-word I/O (needed for PCI configuration space)
+static inline uint32_t inl(uint16_t port) {
+    uint32_t data;
+    __asm__ volatile("inl %1, %0" : "=a"(data) : "Nd"(port));
+    return data;
+}
+
+static inline void outl(uint16_t port, uint32_t data) {
+    __asm__ volatile("outl %0, %1" : : "a"(data), "Nd"(port));
+}
+
 // I/O delay (for slow devices like PIC)
 static inline void io_wait(void) {
     outb(0x80, 0);  // Port 0x80 is used for POST codes, safe to write
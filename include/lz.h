@@ -0,0 +1,22 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include "types.h"
+
+// LZ4-style block codec. A block is a run of sequences, each a token
+// (literal count << 4 | match length - 4, 15 meaning more length bytes
+// follow), the literals, then a 2-byte little-endian match offset and any
+// extra match length bytes. The last sequence has literals only.
+#define LZ_MAX_INPUT    65535   // Offsets and positions are 16-bit
+#define LZ_MIN_MATCH    4
+#define LZ_HASH_BITS    12
+
+// Compress 'len' bytes into at most 'cap' bytes. Returns the compressed
+// size, or 0 if it does not fit (the data is better stored as is).
+uint32_t lz_compress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap);
+
+// Decompress a block into at most 'cap' bytes. Returns the decompressed
+// size, or -1 if the block is malformed or does not fit.
+int32_t lz_decompress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap);
+
+#endif
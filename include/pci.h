@@ -0,0 +1,53 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include "types.h"
+
+// PCI configuration space access ports (mechanism #1)
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+
+// Configuration space register offsets
+#define PCI_VENDOR_ID       0x00    // 16-bit
+#define PCI_DEVICE_ID       0x02    // 16-bit
+#define PCI_COMMAND         0x04    // 16-bit
+#define PCI_STATUS          0x06    // 16-bit
+#define PCI_PROG_IF         0x09    // 8-bit
+#define PCI_SUBCLASS        0x0A    // 8-bit
+#define PCI_CLASS           0x0B    // 8-bit
+#define PCI_HEADER_TYPE     0x0E    // 8-bit
+#define PCI_BAR0            0x10
+#define PCI_BAR4            0x20
+
+// Command register bits
+#define PCI_CMD_IO          0x0001  // I/O space enable
+#define PCI_CMD_MEMORY      0x0002  // Memory space enable
+#define PCI_CMD_BUS_MASTER  0x0004  // Bus master enable
+
+// Class codes
+#define PCI_CLASS_STORAGE   0x01
+#define PCI_SUBCLASS_IDE    0x01
+
+// A device location on the bus
+struct pci_device {
+    uint8_t  bus;
+    uint8_t  slot;
+    uint8_t  func;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t  class_code;
+    uint8_t  subclass;
+    uint8_t  prog_if;
+};
+
+// Configuration space access
+uint32_t pci_read32(const struct pci_device *dev, uint8_t offset);
+uint16_t pci_read16(const struct pci_device *dev, uint8_t offset);
+uint8_t  pci_read8(const struct pci_device *dev, uint8_t offset);
+void pci_write32(const struct pci_device *dev, uint8_t offset, uint32_t value);
+void pci_write16(const struct pci_device *dev, uint8_t offset, uint16_t value);
+
+// Find the first device with the given class/subclass (returns FALSE if none)
+bool pci_find_class(uint8_t class_code, uint8_t subclass, struct pci_device *dev);
+
+#endif
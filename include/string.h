@@ -42,4 +42,7 @@ int int_to_str(int value, char *buf);
 // Convert unsigned integer to string
 int uint_to_str(uint32_t value, char *buf);
 
+// Parse a decimal unsigned integer (FALSE if not a valid number)
+bool str_to_uint(const char *s, uint32_t *value);
+
 #endif
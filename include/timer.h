@@ -0,0 +1,24 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "types.h"
+
+// PIT (8253/8254) I/O ports
+#define PIT_CHANNEL0    0x40    // Channel 0 data port (IRQ0)
+#define PIT_COMMAND     0x43    // Mode/command register
+
+#define PIT_BASE_FREQ   1193182 // Input clock in Hz
+#define PIT_MODE_RATE   0x36    // Channel 0, lo/hi byte, mode 3 (square wave)
+
+// System tick rate
+#define TIMER_HZ        100
+
+// Convert milliseconds to ticks (rounded up, at least one tick)
+#define TIMER_MS_TO_TICKS(ms)   (((ms) * TIMER_HZ + 999) / 1000)
+
+// Function prototypes
+void timer_init(uint32_t hz);
+void timer_handler(void);
+uint32_t timer_get_ticks(void);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include "types.h"
+#include "fs.h"
+
+// tmpfs: a RAM filesystem for scratch data. Nodes and 4KB data pages are
+// taken from fixed pools as files grow and returned as they shrink or go
+// away; nothing survives a reboot. Paths are relative to the tmpfs root.
+#define TMPFS_PAGE_SIZE     4096
+#define TMPFS_PAGES         512     // 2MB of file data
+#define TMPFS_MAX_NODES     256     // Files and directories, root included
+#define TMPFS_ROOT          0
+#define TMPFS_NONE          0xFFFF  // End of a page chain or entry list
+
+// Node: a file or directory. Entries of a directory are linked through
+// their next_sibling; a file's pages are chained in the page table.
+struct tmpfs_node {
+    uint8_t  type;                  // INODE_TYPE_* (FREE when unused)
+    uint16_t parent;
+    uint16_t first_child;           // Directories
+    uint16_t next_sibling;          // Within the parent, or in the free list
+    uint16_t first_page;            // Files
+    uint16_t page_count;
+    uint32_t size;
+    char     name[FS_MAX_FILENAME];
+};
+
+// Pool usage
+struct tmpfs_stats {
+    uint32_t nodes_used;
+    uint32_t pages_used;
+};
+
+// Filesystem state. Free nodes are linked through next_sibling and free
+// pages through page_next, so both allocate and free in constant time.
+struct tmpfs_state {
+    struct tmpfs_node nodes[TMPFS_MAX_NODES];
+    uint16_t free_node;                 // Head of the free node list
+    uint16_t page_next[TMPFS_PAGES];    // Next page of the same file (or free list)
+    uint16_t free_page;                 // Head of the free page list
+    struct tmpfs_stats stats;
+    uint8_t  pages[TMPFS_PAGES][TMPFS_PAGE_SIZE];
+};
+
+void tmpfs_init(void);
+
+// Directory operations
+bool tmpfs_mkdir(const char *path);
+bool tmpfs_list_dir(const char *path);
+bool tmpfs_read_dir(const char *path, uint32_t *cursor, struct dir_entry *entry);  // Next entry from *cursor (start at 0), FALSE at the end
+
+// File operations, the same as fs_* with node numbers for inodes
+bool tmpfs_create(const char *path);
+bool tmpfs_exists(const char *path);
+bool tmpfs_open(const char *path, uint32_t *node);
+bool tmpfs_read(uint32_t node, void *buf, uint32_t *size);
+bool tmpfs_write(uint32_t node, const void *buf, uint32_t size);
+bool tmpfs_delete(const char *path);
+
+// Byte-granular access; a write past the end fills the gap with zeros
+int32_t tmpfs_pread(uint32_t node, void *buf, uint32_t len, uint32_t offset);
+int32_t tmpfs_pwrite(uint32_t node, const void *buf, uint32_t len, uint32_t offset);
+bool    tmpfs_truncate(uint32_t node, uint32_t size);
+
+bool tmpfs_get_node(uint32_t node, struct tmpfs_node *out);
+void tmpfs_get_stats(struct tmpfs_stats *stats);
+
+// Operations for mounting in the VFS (vfs.h)
+struct vnode_ops;
+extern const struct vnode_ops tmpfs_vnode_ops;
+
+#endif
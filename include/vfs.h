@@ -0,0 +1,90 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include "types.h"
+#include "fs.h"
+
+// Virtual filesystem: one namespace over every mounted filesystem. Paths
+// may be absolute or relative to the working directory; "." and ".." are
+// resolved on the path itself, so ".." leaves a mount the way it came in.
+// A mount point does not need a directory of that name underneath it.
+#define VFS_MAX_MOUNTS      8
+#define VFS_MAX_VNODES      32
+
+// What getattr reports about a node
+struct vnode_attr {
+    uint8_t  type;                  // INODE_TYPE_FILE or INODE_TYPE_DIR
+    uint8_t  flags;                 // INODE_FLAG_COMPRESSED where supported
+    uint32_t size;                  // Bytes, for files
+};
+
+// Operations a filesystem provides. Nodes are named by the filesystem's
+// own numbers; a NULL set_compressed means the setting is not supported.
+struct vnode_ops {
+    const char *name;
+    uint32_t (*root)(void);
+    bool     (*lookup)(uint32_t dir, const char *name, uint32_t *node, uint8_t *type);
+    bool     (*create)(uint32_t dir, const char *name, uint8_t type);
+    bool     (*remove)(uint32_t dir, const char *name);
+    bool     (*read_dir)(uint32_t dir, uint32_t *cursor, struct dir_entry *entry);
+    int32_t  (*read)(uint32_t node, void *buf, uint32_t len, uint32_t offset);
+    int32_t  (*write)(uint32_t node, const void *buf, uint32_t len, uint32_t offset);
+    bool     (*truncate)(uint32_t node, uint32_t size);
+    bool     (*getattr)(uint32_t node, struct vnode_attr *attr);
+    bool     (*set_compressed)(uint32_t node, bool on);
+    bool     (*sync)(void);     // Make everything written so far durable
+};
+
+struct vfs_mount {
+    bool     used;
+    char     path[FS_MAX_PATH];     // Normalized, "/" for the root
+    const struct vnode_ops *ops;
+};
+
+// A node in use. Vnodes are shared: looking up a node that already has one
+// takes another reference to it. Unreferenced vnodes stay cached until
+// their slot is needed.
+struct vnode {
+    struct vfs_mount *mnt;          // NULL if the slot is free
+    uint32_t node;
+    uint8_t  type;
+    uint32_t refs;
+};
+
+struct vfs_state {
+    struct vfs_mount mounts[VFS_MAX_MOUNTS];
+    struct vnode vnodes[VFS_MAX_VNODES];
+    uint32_t vnode_hand;            // Next slot to consider for reuse
+    char     cwd[FS_MAX_PATH];
+};
+
+void vfs_init(void);
+
+// Mount table. Unmounting fails while nodes of the mount are referenced.
+bool vfs_mount(const char *path, const struct vnode_ops *ops);
+bool vfs_unmount(const char *path);
+const struct vfs_mount *vfs_get_mount(uint32_t index);     // NULL if unused or out of range
+
+// Path operations
+const char* vfs_get_cwd(void);
+bool vfs_chdir(const char *path);
+bool vfs_mkdir(const char *path);
+bool vfs_create(const char *path);
+bool vfs_exists(const char *path);
+bool vfs_remove(const char *path);
+bool vfs_stat(const char *path, struct vnode_attr *attr);
+bool vfs_list_dir(const char *path);     // NULL for the working directory
+bool vfs_read_dir(const char *path, uint32_t *cursor, struct dir_entry *entry);  // Next entry from *cursor (start at 0), FALSE at the end
+bool vfs_set_compressed(const char *path, bool on);
+bool vfs_sync(void);                     // Every mounted filesystem
+
+// Node operations on a referenced vnode
+struct vnode *vfs_open(const char *path);   // NULL on error
+void    vfs_close(struct vnode *vn);
+int32_t vfs_read(struct vnode *vn, void *buf, uint32_t len, uint32_t offset);
+int32_t vfs_write(struct vnode *vn, const void *buf, uint32_t len, uint32_t offset);
+bool    vfs_truncate(struct vnode *vn, uint32_t size);
+bool    vfs_getattr(struct vnode *vn, struct vnode_attr *attr);
+bool    vfs_fsync(struct vnode *vn);       // The vnode's filesystem only
+
+#endif
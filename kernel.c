@@ -4,8 +4,11 @@
 #include "idt.h"
 #include "pic.h"
 #include "keyboard.h"
+#include "timer.h"
 #include "ata.h"
 #include "fs.h"
+#include "tmpfs.h"
+#include "vfs.h"
 #include "shell.h"
 
 // Exception names for debugging
@@ -92,15 +95,16 @@ void irq_handler(uint32_t *regs) {
 
     switch (irq) {
         case 0:  // Timer (IRQ0)
-            // Timer tick handling (not implemented yet)
+            timer_handler();
             break;
         case 1:  // Keyboard (IRQ1)
             keyboard_handler();
             break;
         case 14: // Primary ATA (IRQ14)
-            // ATA interrupt handling (for DMA mode - not used in PIO)
+            ata_irq_handler(0);
             break;
         case 15: // Secondary ATA (IRQ15)
+            ata_irq_handler(1);
             break;
     }
 
@@ -128,6 +132,12 @@ void kmain(void) {
     vga_puts("[*] Enabling interrupts\n");
     __asm__ volatile("sti");
 
+    // Initialize system timer (drives I/O timeouts)
+    vga_puts("[*] Timer: PIT at ");
+    vga_put_dec(TIMER_HZ);
+    vga_puts(" Hz\n");
+    timer_init(TIMER_HZ);
+
     // Initialize keyboard
     vga_puts("[*] Keyboard: Initializing PS/2 driver\n");
     keyboard_init();
@@ -140,6 +150,18 @@ void kmain(void) {
     vga_puts("[*] Filesystem: ");
     fs_init();
 
+    // Initialize RAM filesystem
+    vga_puts("[*] tmpfs: ");
+    tmpfs_init();
+    vga_put_dec(TMPFS_PAGES * TMPFS_PAGE_SIZE / 1024);
+    vga_puts(" KB in RAM\n");
+
+    // One namespace over both: the disk at the root, tmpfs at /tmp
+    vga_puts("[*] VFS: monkeyfs on /, tmpfs on /tmp\n");
+    vfs_init();
+    vfs_mount("/", &fs_vnode_ops);
+    vfs_mount("/tmp", &tmpfs_vnode_ops);
+
     // System ready - start shell
     vga_puts("\n");
     vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
@@ -149,7 +171,8 @@ void kmain(void) {
     // Run the shell (main user interface)
     shell_run();
 
-    // If shell exits, halt
+    // If shell exits, make pending writes durable and halt
+    vfs_sync();
     vga_puts("\nShell exited. System halted.\n");
     while (1) {
         __asm__ volatile("cli; hlt");
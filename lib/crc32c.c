@@ -0,0 +1,100 @@
+#include "crc32c.h"
+
+#define CRC32C_POLY     0x82F63B78
+
+// x86 allows unaligned loads; this type lets a byte buffer be read a word
+// at a time without breaking aliasing rules
+typedef uint32_t __attribute__((may_alias)) word32_t;
+typedef uint64_t __attribute__((may_alias)) word64_t;
+
+// Slice-by-8: table[k][b] is the CRC of byte b followed by k zero bytes
+static uint32_t table[8][256];
+static bool ready;
+static bool hardware;
+
+// Helper: Check CPUID leaf 1 for SSE4.2 (ECX bit 20). Every CPU that can
+// run this kernel has CPUID.
+static bool has_sse42(void) {
+#if defined(__i386__) || defined(__x86_64__)
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return (ecx >> 20) & 1;
+#else
+    return FALSE;
+#endif
+}
+
+static void init(void) {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+        }
+        table[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xFF];
+        }
+    }
+
+    hardware = has_sse42();
+    ready = TRUE;
+}
+
+// Helper: Eight bytes per round, one lookup per byte
+static uint32_t crc_table(uint32_t crc, const uint8_t *p, uint32_t len) {
+    while (len >= 8) {
+        uint32_t lo = *(const word32_t*)p ^ crc;
+        uint32_t hi = *(const word32_t*)(p + 4);
+        crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^
+              table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+              table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^
+              table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+// Helper: The crc32 instruction, a word (or on x86-64 a quadword) at a time
+static uint32_t crc_hardware(uint32_t crc, const uint8_t *p, uint32_t len) {
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        __asm__("crc32q %1, %0" : "+r"(crc64) : "rm"(*(const word64_t*)p));
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len >= 4) {
+        __asm__("crc32l %1, %0" : "+r"(crc) : "rm"(*(const word32_t*)p));
+        p += 4;
+        len -= 4;
+    }
+    while (len--) {
+        __asm__("crc32b %1, %0" : "+r"(crc) : "rm"(*p++));
+    }
+    return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *buf, uint32_t len) {
+    if (!ready) init();
+
+    crc = ~crc;
+#if defined(__i386__) || defined(__x86_64__)
+    if (hardware) return ~crc_hardware(crc, buf, len);
+#endif
+    return ~crc_table(crc, buf, len);
+}
+
+bool crc32c_hardware(void) {
+    if (!ready) init();
+    return hardware;
+}
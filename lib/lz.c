@@ -0,0 +1,139 @@
+#include "lz.h"
+
+// Most recent position of each 4-byte prefix hash (compression only)
+static uint16_t table[1 << LZ_HASH_BITS];
+
+static uint32_t read32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Helper: Emit a length's continuation bytes (after the 15 in the token)
+static uint32_t put_length(uint8_t *dst, uint32_t op, uint32_t n) {
+    while (n >= 255) {
+        dst[op++] = 255;
+        n -= 255;
+    }
+    dst[op++] = n;
+    return op;
+}
+
+// Helper: Emit one sequence: literals [lit, lit + lit_len), then a match of
+// 'match_len' bytes 'offset' back (match_len 0 for the last sequence).
+// Returns the new output position, 0 if it does not fit.
+static uint32_t put_sequence(uint8_t *dst, uint32_t op, uint32_t cap, const uint8_t *lit,
+                             uint32_t lit_len, uint32_t offset, uint32_t match_len) {
+    // Worst case: token, length bytes for both, literals and offset
+    if (op + 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1 > cap) {
+        return 0;
+    }
+
+    uint32_t ml = match_len >= LZ_MIN_MATCH ? match_len - LZ_MIN_MATCH : 0;
+    uint32_t token = op++;
+    dst[token] = ((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15);
+
+    if (lit_len >= 15) op = put_length(dst, op, lit_len - 15);
+    for (uint32_t i = 0; i < lit_len; i++) {
+        dst[op++] = lit[i];
+    }
+
+    if (match_len == 0) return op;
+
+    dst[op++] = offset & 0xFF;
+    dst[op++] = offset >> 8;
+    if (ml >= 15) op = put_length(dst, op, ml - 15);
+    return op;
+}
+
+uint32_t lz_compress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap) {
+    if (len > LZ_MAX_INPUT) return 0;
+
+    for (uint32_t i = 0; i < (1 << LZ_HASH_BITS); i++) {
+        table[i] = 0;
+    }
+
+    uint32_t ip = 0;
+    uint32_t anchor = 0;
+    uint32_t op = 0;
+
+    // Greedy: take the first match the hash table offers, no lazy search
+    while (ip + LZ_MIN_MATCH <= len) {
+        uint32_t seq = read32(src + ip);
+        uint32_t h = hash(seq);
+        uint32_t ref = table[h];
+        table[h] = ip;
+
+        if (ref >= ip || read32(src + ref) != seq) {
+            ip++;
+            continue;
+        }
+
+        uint32_t match_len = LZ_MIN_MATCH;
+        while (ip + match_len < len && src[ref + match_len] == src[ip + match_len]) {
+            match_len++;
+        }
+
+        op = put_sequence(dst, op, cap, src + anchor, ip - anchor, ip - ref, match_len);
+        if (op == 0) return 0;
+
+        ip += match_len;
+        anchor = ip;
+    }
+
+    // Whatever is left goes out as literals
+    op = put_sequence(dst, op, cap, src + anchor, len - anchor, 0, 0);
+    return op;
+}
+
+int32_t lz_decompress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap) {
+    uint32_t ip = 0;
+    uint32_t op = 0;
+
+    while (ip < len) {
+        uint32_t token = src[ip++];
+
+        uint32_t lit_len = token >> 4;
+        if (lit_len == 15) {
+            uint32_t b;
+            do {
+                if (ip >= len) return -1;
+                b = src[ip++];
+                lit_len += b;
+            } while (b == 255);
+        }
+        if (lit_len > len - ip || lit_len > cap - op) return -1;
+
+        for (uint32_t i = 0; i < lit_len; i++) {
+            dst[op++] = src[ip++];
+        }
+
+        // The last sequence ends the block after its literals
+        if (ip == len) break;
+
+        if (len - ip < 2) return -1;
+        uint32_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) return -1;
+
+        uint32_t match_len = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15) {
+            uint32_t b;
+            do {
+                if (ip >= len) return -1;
+                b = src[ip++];
+                match_len += b;
+            } while (b == 255);
+        }
+        if (match_len > cap - op) return -1;
+
+        // Byte by byte: a match may overlap the bytes it produces
+        const uint8_t *ref = dst + op - offset;
+        for (uint32_t i = 0; i < match_len; i++) {
+            dst[op++] = ref[i];
+        }
+    }
+    return (int32_t)op;
+}
@@ -152,3 +152,21 @@ int uint_to_str(uint32_t value, char *buf) {
 
     return len;
 }
+
+bool str_to_uint(const char *s, uint32_t *value) {
+    uint32_t result = 0;
+
+    if (*s == '\0') return FALSE;
+
+    while (*s) {
+        if (*s < '0' || *s > '9') return FALSE;
+
+        uint32_t digit = *s - '0';
+        if (result > (0xFFFFFFFF - digit) / 10) return FALSE;  // Overflow
+        result = result * 10 + digit;
+        s++;
+    }
+
+    *value = result;
+    return TRUE;
+}
@@ -3,6 +3,9 @@
 #include "keyboard.h"
 #include "string.h"
 #include "fs.h"
+#include "vfs.h"
+#include "bcache.h"
+#include "crc32c.h"
 #include "editor.h"
 
 // Forward declarations
@@ -14,7 +17,12 @@ static void cmd_cd(int argc, char args[][MAX_ARG_LEN]);
 static void cmd_mkdir(int argc, char args[][MAX_ARG_LEN]);
 static void cmd_touch(int argc, char args[][MAX_ARG_LEN]);
 static void cmd_change(int argc, char args[][MAX_ARG_LEN]);
+static void cmd_compress(int argc, char args[][MAX_ARG_LEN]);
 static void cmd_format(int argc, char args[][MAX_ARG_LEN]);
+static void cmd_sync(int argc, char args[][MAX_ARG_LEN]);
+static void cmd_cache(int argc, char args[][MAX_ARG_LEN]);
+static void cmd_checksum(int argc, char args[][MAX_ARG_LEN]);
+static void cmd_mount(int argc, char args[][MAX_ARG_LEN]);
 
 // Command table
 const struct command commands[] = {
@@ -26,7 +34,12 @@ const struct command commands[] = {
     {"mkdir",  cmd_mkdir,  "Create a directory"},
     {"touch",  cmd_touch,  "Create an empty file"},
     {"change", cmd_change, "Edit a file (nano-like)"},
+    {"compress", cmd_compress, "Compress a file or directory's new files"},
     {"format", cmd_format, "Format the filesystem"},
+    {"sync",   cmd_sync,   "Flush pending writes to disk"},
+    {"cache",  cmd_cache,  "Show block cache statistics"},
+    {"checksum", cmd_checksum, "Show sector checksum statistics"},
+    {"mount",  cmd_mount,  "List mounted filesystems"},
     {NULL, NULL, NULL}
 };
 
@@ -66,46 +79,37 @@ static void cmd_pwd(int argc, char args[][MAX_ARG_LEN]) {
     (void)argc;
     (void)args;
 
-    if (!fs_is_mounted()) {
-        vga_puts("Filesystem not mounted.\n");
-        return;
-    }
-
-    vga_puts(fs_get_cwd());
+    vga_puts(vfs_get_cwd());
     vga_putchar('\n');
 }
 
 static void cmd_ls(int argc, char args[][MAX_ARG_LEN]) {
-    (void)argc;
-    (void)args;
-
-    if (!fs_is_mounted()) {
-        vga_puts("Filesystem not mounted. Use 'format' to create one.\n");
-        return;
-    }
+    // Optional path, the working directory by default
+    const char *path = (argc > 1) ? args[1] : NULL;
 
     vga_set_color(VGA_LIGHT_CYAN, VGA_BLACK);
     vga_puts("Directory: ");
-    vga_puts(fs_get_cwd());
+    vga_puts(path ? path : vfs_get_cwd());
     vga_putchar('\n');
     vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
 
-    fs_list_dir();
+    if (!vfs_list_dir(path)) {
+        vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+        vga_puts("ls: ");
+        vga_puts(path ? path : vfs_get_cwd());
+        vga_puts(": No such directory\n");
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    }
 }
 
 static void cmd_cd(int argc, char args[][MAX_ARG_LEN]) {
-    if (!fs_is_mounted()) {
-        vga_puts("Filesystem not mounted.\n");
-        return;
-    }
-
     if (argc < 2) {
         // cd with no args goes to root
-        fs_chdir("/");
+        vfs_chdir("/");
         return;
     }
 
-    if (!fs_chdir(args[1])) {
+    if (!vfs_chdir(args[1])) {
         vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
         vga_puts("cd: ");
         vga_puts(args[1]);
@@ -115,17 +119,12 @@ static void cmd_cd(int argc, char args[][MAX_ARG_LEN]) {
 }
 
 static void cmd_mkdir(int argc, char args[][MAX_ARG_LEN]) {
-    if (!fs_is_mounted()) {
-        vga_puts("Filesystem not mounted.\n");
-        return;
-    }
-
     if (argc < 2) {
         vga_puts("Usage: mkdir <dirname>\n");
         return;
     }
 
-    if (fs_mkdir(args[1])) {
+    if (vfs_mkdir(args[1])) {
         vga_puts("Directory created: ");
         vga_puts(args[1]);
         vga_putchar('\n');
@@ -139,24 +138,19 @@ static void cmd_mkdir(int argc, char args[][MAX_ARG_LEN]) {
 }
 
 static void cmd_touch(int argc, char args[][MAX_ARG_LEN]) {
-    if (!fs_is_mounted()) {
-        vga_puts("Filesystem not mounted.\n");
-        return;
-    }
-
     if (argc < 2) {
         vga_puts("Usage: touch <filename>\n");
         return;
     }
 
-    if (fs_exists(args[1])) {
+    if (vfs_exists(args[1])) {
         vga_puts("File already exists: ");
         vga_puts(args[1]);
         vga_putchar('\n');
         return;
     }
 
-    if (fs_create(args[1])) {
+    if (vfs_create(args[1])) {
         vga_puts("File created: ");
         vga_puts(args[1]);
         vga_putchar('\n');
@@ -170,11 +164,6 @@ static void cmd_touch(int argc, char args[][MAX_ARG_LEN]) {
 }
 
 static void cmd_change(int argc, char args[][MAX_ARG_LEN]) {
-    if (!fs_is_mounted()) {
-        vga_puts("Filesystem not mounted.\n");
-        return;
-    }
-
     if (argc < 2) {
         vga_puts("Usage: change <filename>\n");
         return;
@@ -183,9 +172,51 @@ static void cmd_change(int argc, char args[][MAX_ARG_LEN]) {
     editor_run(args[1]);
 }
 
+static void cmd_compress(int argc, char args[][MAX_ARG_LEN]) {
+    bool on = TRUE;
+    if (argc == 3 && str_cmp(args[2], "off") == 0) {
+        on = FALSE;
+    } else if (argc != 2 && (argc != 3 || str_cmp(args[2], "on") != 0)) {
+        vga_puts("Usage: compress <path> [on|off]\n");
+        vga_puts("  A file is converted in place (up to 2MB); a directory\n");
+        vga_puts("  passes the setting on to files and directories created in it\n");
+        return;
+    }
+
+    if (vfs_set_compressed(args[1], on)) {
+        vga_puts(on ? "Compressed: " : "Uncompressed: ");
+        vga_puts(args[1]);
+        vga_putchar('\n');
+    } else {
+        vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+        vga_puts("compress: Cannot change '");
+        vga_puts(args[1]);
+        vga_puts("'\n");
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    }
+}
+
 static void cmd_format(int argc, char args[][MAX_ARG_LEN]) {
-    (void)argc;
-    (void)args;
+    // Optional cluster size in bytes and inode count (0 = default for either)
+    uint32_t cluster_size = 0;
+    uint32_t inode_count = 0;
+    bool ok = TRUE;
+    if (argc > 1) {
+        ok = str_to_uint(args[1], &cluster_size) &&
+             (cluster_size == 0 ||
+              (cluster_size >= FS_MIN_CLUSTER_SIZE && cluster_size <= FS_MAX_CLUSTER_SIZE &&
+               (cluster_size & (cluster_size - 1)) == 0));
+    }
+    if (ok && argc > 2) {
+        ok = str_to_uint(args[2], &inode_count) &&
+             (inode_count == 0 || (inode_count >= FS_MIN_INODES && inode_count <= FS_MAX_INODES));
+    }
+    if (!ok) {
+        vga_puts("Usage: format [cluster_bytes] [inodes]\n");
+        vga_puts("  cluster_bytes: power of two, 512 to 65536\n");
+        vga_puts("  inodes: 64 to 1048576 (default: one per 16KB of disk)\n");
+        return;
+    }
 
     vga_set_color(VGA_YELLOW, VGA_BLACK);
     vga_puts("WARNING: This will erase all data on the disk!\n");
@@ -216,7 +247,8 @@ static void cmd_format(int argc, char args[][MAX_ARG_LEN]) {
     keyboard_set_echo(TRUE);
 
     if (str_cmp(confirm, "yes") == 0) {
-        if (fs_format()) {
+        if (fs_format(cluster_size, inode_count)) {
+            vfs_chdir("/");     // The old working directory is gone
             vga_set_color(VGA_LIGHT_GREEN, VGA_BLACK);
             vga_puts("Filesystem formatted successfully.\n");
             vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
@@ -229,3 +261,86 @@ static void cmd_format(int argc, char args[][MAX_ARG_LEN]) {
         vga_puts("Format cancelled.\n");
     }
 }
+
+static void cmd_sync(int argc, char args[][MAX_ARG_LEN]) {
+    (void)argc;
+    (void)args;
+
+    if (!vfs_sync()) {
+        vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+        vga_puts("sync: Failed to flush disk cache\n");
+        vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    }
+}
+
+static void cmd_cache(int argc, char args[][MAX_ARG_LEN]) {
+    (void)argc;
+    (void)args;
+
+    struct bcache_stats stats;
+    bcache_get_stats(&stats);
+
+    vga_puts("Block cache (");
+    vga_put_dec(BCACHE_BUFFERS);
+    vga_puts(" x ");
+    vga_put_dec(BCACHE_BLOCK_SIZE);
+    vga_puts(" bytes)\n");
+
+    vga_puts("  Hits:       ");
+    vga_put_dec(stats.hits);
+    vga_puts("\n  Misses:     ");
+    vga_put_dec(stats.misses);
+    vga_puts("\n  Evictions:  ");
+    vga_put_dec(stats.evictions);
+    vga_puts("\n  Writebacks: ");
+    vga_put_dec(stats.writebacks);
+    vga_puts("\n  Readahead:  ");
+    vga_put_dec(stats.prefetches);
+    vga_putchar('\n');
+}
+
+static void cmd_checksum(int argc, char args[][MAX_ARG_LEN]) {
+    (void)argc;
+    (void)args;
+
+    struct fs_csum_stats stats;
+    fs_get_csum_stats(&stats);
+
+    vga_puts("CRC32C sector checksums (");
+    vga_puts(crc32c_hardware() ? "SSE4.2" : "slice-by-8 tables");
+    vga_puts(")\n");
+
+    vga_puts("  Verified:   ");
+    vga_put_dec(stats.verified);
+    vga_puts("\n  Unrecorded: ");
+    vga_put_dec(stats.unrecorded);
+    vga_puts("\n  Mismatches: ");
+    if (stats.mismatches > 0) vga_set_color(VGA_LIGHT_RED, VGA_BLACK);
+    vga_put_dec(stats.mismatches);
+    vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
+    if (stats.mismatches > 0) {
+        vga_puts(" (last in sector ");
+        vga_put_dec(stats.last_bad);
+        vga_putchar(')');
+    }
+    vga_putchar('\n');
+}
+
+static void cmd_mount(int argc, char args[][MAX_ARG_LEN]) {
+    (void)argc;
+    (void)args;
+
+    for (uint32_t i = 0; i < VFS_MAX_MOUNTS; i++) {
+        const struct vfs_mount *m = vfs_get_mount(i);
+        if (m == NULL) continue;
+
+        vga_puts("  ");
+        vga_puts(m->ops->name);
+        vga_puts(" on ");
+        vga_puts(m->path);
+        if (m->ops == &fs_vnode_ops && !fs_is_mounted()) {
+            vga_puts(" (no filesystem, use 'format')");
+        }
+        vga_putchar('\n');
+    }
+}
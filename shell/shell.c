@@ -2,7 +2,7 @@
 #include "vga.h"
 #include "keyboard.h"
 #include "string.h"
-#include "fs.h"
+#include "vfs.h"
 
 static struct shell_state shell;
 
@@ -22,7 +22,7 @@ void shell_print_prompt(void) {
     vga_set_color(VGA_WHITE, VGA_BLACK);
     vga_putchar(':');
     vga_set_color(VGA_LIGHT_BLUE, VGA_BLACK);
-    vga_puts(fs_get_cwd());
+    vga_puts(vfs_get_cwd());
     vga_set_color(VGA_WHITE, VGA_BLACK);
     vga_puts("$ ");
     vga_set_color(VGA_LIGHT_GREY, VGA_BLACK);
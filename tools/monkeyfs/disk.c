@@ -0,0 +1,144 @@
+#include "ata.h"
+#include "vga.h"
+#include "string.h"
+#include "disk.h"
+#include "host.h"
+
+// The driver and console calls made by fs.c and bcache.c, served from the
+// disk image. Requests complete synchronously; each counts as one command,
+// except that reads queued while plugged are held and counted the way the
+// driver merges them.
+
+#define HELD_MAX    64
+#define MERGE_MAX   16      // Requests per command, as ATA_MAX_SEGMENTS
+
+static struct ata_drive drive0;
+static struct disk_stats stats;
+static struct ata_request *held[HELD_MAX];
+static uint32_t held_count;
+static uint32_t plugged;
+
+bool ata_read_sectors(uint8_t drive, uint64_t lba, uint32_t count, void *buffer) {
+    stats.read_cmds++;
+    stats.read_sectors += count;
+    return drive == 0 && host_image_read(lba, count, buffer);
+}
+
+bool ata_write_sectors(uint8_t drive, uint64_t lba, uint32_t count, const void *buffer) {
+    stats.write_cmds++;
+    stats.write_sectors += count;
+    return drive == 0 && host_image_write(lba, count, buffer);
+}
+
+bool ata_flush(uint8_t drive) {
+    stats.flushes++;
+    return drive == 0 && host_image_sync();
+}
+
+static void complete(struct ata_request *req, bool ok) {
+    req->done = ok ? req->count : 0;
+    req->status = ok ? ATA_REQ_DONE : ATA_REQ_ERROR;
+    if (req->callback != NULL) {
+        req->callback(req);
+    }
+}
+
+// Serve the held reads in order, one command per contiguous run
+static void release_held(void) {
+    uint64_t end = 0;
+    uint32_t merged = 0;
+
+    for (uint32_t i = 0; i < held_count; i++) {
+        struct ata_request *req = held[i];
+        if (merged == 0 || merged == MERGE_MAX || req->lba != end) {
+            stats.read_cmds++;
+            merged = 0;
+        }
+        merged++;
+        end = req->lba + req->count;
+        stats.read_sectors += req->count;
+        complete(req, req->drive == 0 && host_image_read(req->lba, req->count, req->buffer));
+    }
+    held_count = 0;
+}
+
+void ata_plug(uint8_t drive) {
+    (void)drive;
+    plugged++;
+}
+
+void ata_unplug(uint8_t drive) {
+    (void)drive;
+    if (plugged > 0 && --plugged == 0) release_held();
+}
+
+bool ata_submit(struct ata_request *req) {
+    if (plugged > 0 && req->type == ATA_REQ_READ && held_count < HELD_MAX) {
+        req->status = ATA_REQ_PENDING;
+        held[held_count++] = req;
+        return TRUE;
+    }
+
+    bool ok;
+    if (req->type == ATA_REQ_READ) {
+        ok = ata_read_sectors(req->drive, req->lba, req->count, req->buffer);
+    } else if (req->type == ATA_REQ_WRITE) {
+        ok = ata_write_sectors(req->drive, req->lba, req->count, req->buffer);
+    } else {
+        ok = ata_flush(req->drive);
+    }
+
+    complete(req, ok);
+    return TRUE;
+}
+
+bool ata_wait(struct ata_request *req) {
+    if (req->status == ATA_REQ_PENDING) {
+        plugged = 0;
+        release_held();
+    }
+    return req->status == ATA_REQ_DONE;
+}
+
+struct ata_drive* ata_get_drive(uint8_t drive) {
+    if (drive != 0) return NULL;
+
+    drive0.present = TRUE;
+    drive0.lba48 = TRUE;
+    drive0.size_sectors = host_image_sectors();
+    return &drive0;
+}
+
+void disk_get_stats(struct disk_stats *out) {
+    mem_cpy(out, &stats, sizeof(stats));
+}
+
+void disk_reset_stats(void) {
+    mem_set(&stats, 0, sizeof(stats));
+}
+
+void vga_puts(const char *str) {
+    host_print(str);
+}
+
+void vga_putchar(char c) {
+    char s[2] = { c, '\0' };
+    host_print(s);
+}
+
+void vga_put_dec(uint32_t value) {
+    char buf[12];
+    int i = sizeof(buf) - 1;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    host_print(&buf[i]);
+}
+
+void vga_set_color(uint8_t fg, uint8_t bg) {
+    (void)fg;
+    (void)bg;
+}
@@ -0,0 +1,18 @@
+#ifndef DISK_H
+#define DISK_H
+
+#include "types.h"
+
+// I/O reaching the image, whichever path it took (direct or queued)
+struct disk_stats {
+    uint32_t read_cmds;
+    uint32_t write_cmds;
+    uint32_t flushes;
+    uint64_t read_sectors;
+    uint64_t write_sectors;
+};
+
+void disk_get_stats(struct disk_stats *stats);
+void disk_reset_stats(void);
+
+#endif
@@ -0,0 +1,327 @@
+#include "fs.h"
+#include "bcache.h"
+#include "string.h"
+#include "disk.h"
+#include "host.h"
+
+// fsbench: scripted MonkeyFS workloads on the build host. The kernel's fs.c
+// and bcache.c run over a memory-backed disk (or an image file with -f), and
+// every command reaching the disk is counted, so runs are repeatable and
+// comparable across commits.
+//
+//   fsbench [-n files] [-d depth] [-s write_mb] [-r rounds] [-k files_per_round]
+//           [-c cluster_bytes] [-m disk_mb] [-f image] [-z] [workload...]
+//
+// Workloads: create, mkdir, write, read, churn (default: all, in that order).
+// With -z everything is created compressed.
+// Latency is per operation; totals and I/O also include the sync that ends
+// each workload. Amplification is sectors moved per sector of file data.
+
+#define CHUNK           65536       // Bytes per append/read call
+#define CHURN_BYTES     1024        // File size in the churn workload
+
+static uint8_t chunk_buf[CHUNK];
+
+static uint32_t opt_files = 1000;
+static uint32_t opt_depth = 100;
+static uint32_t opt_write_mb = 8;
+static uint32_t opt_rounds = 20;
+static uint32_t opt_round_files = 50;
+
+// Per-workload measurements
+struct bench {
+    const char *name;
+    uint32_t ops;
+    uint64_t start_ns;
+    uint64_t op_start_ns;
+    uint64_t max_ns;
+    uint64_t op_total_ns;
+    uint64_t payload;               // File bytes moved (0 for metadata workloads)
+    struct bcache_stats cache;      // At the start
+};
+
+static void put_dec(uint64_t value, uint32_t width) {
+    char buf[24];
+    int i = sizeof(buf) - 1;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    for (uint32_t n = sizeof(buf) - 1 - i; n < width; n++) host_print(" ");
+    host_print(&buf[i]);
+}
+
+// Helper: Print value/div with one decimal, right-aligned
+static void put_ratio(uint64_t value, uint64_t div, uint32_t width) {
+    if (div == 0) {
+        for (uint32_t n = 1; n < width; n++) host_print(" ");
+        host_print("-");
+        return;
+    }
+
+    uint64_t tenths = (value * 10 + div / 2) / div;
+    put_dec(tenths / 10, width > 2 ? width - 2 : 0);
+    host_print(".");
+    put_dec(tenths % 10, 1);
+}
+
+static void bench_begin(struct bench *b, const char *name) {
+    mem_set(b, 0, sizeof(*b));
+    b->name = name;
+    bcache_get_stats(&b->cache);
+    disk_reset_stats();
+    b->start_ns = host_time_ns();
+}
+
+static void op_begin(struct bench *b) {
+    b->op_start_ns = host_time_ns();
+}
+
+static void op_end(struct bench *b) {
+    uint64_t ns = host_time_ns() - b->op_start_ns;
+    b->op_total_ns += ns;
+    if (ns > b->max_ns) b->max_ns = ns;
+    b->ops++;
+}
+
+static bool bench_end(struct bench *b, bool ok) {
+    if (!fs_sync()) ok = FALSE;
+
+    uint64_t total_ns = host_time_ns() - b->start_ns;
+    struct disk_stats io;
+    struct bcache_stats cache;
+    disk_get_stats(&io);
+    bcache_get_stats(&cache);
+
+    uint64_t sectors = io.read_sectors + io.write_sectors;
+
+    host_print(b->name);
+    for (uint32_t n = str_len(b->name); n < 8; n++) host_print(" ");
+    put_dec(b->ops, 7);
+    put_ratio(total_ns, 1000000, 10);
+    put_ratio(b->op_total_ns, b->ops * 1000ull, 9);
+    put_ratio(b->max_ns, 1000, 9);
+    put_dec(io.read_cmds, 8);
+    put_dec(io.read_sectors, 9);
+    put_dec(io.write_cmds, 8);
+    put_dec(io.write_sectors, 9);
+    put_dec(io.flushes, 6);
+    put_ratio(sectors, b->ops, 9);
+    put_ratio(sectors * FS_SECTOR_SIZE, b->payload, 7);
+    put_dec(cache.hits - b->cache.hits, 9);
+    put_dec(cache.misses - b->cache.misses, 8);
+    host_print(ok ? "\n" : "  FAILED\n");
+    return ok;
+}
+
+// Helper: "/<dir>/f<n>"
+static void file_name(char *path, const char *dir, uint32_t n) {
+    str_cpy(path, dir);
+    str_cat(path, "/f");
+    uint_to_str(n, path + str_len(path));
+}
+
+// Workload: create files in one directory
+static bool run_create(void) {
+    struct bench b;
+    char path[FS_MAX_PATH];
+    bool ok = fs_mkdir("/create");
+
+    bench_begin(&b, "create");
+    for (uint32_t i = 0; ok && i < opt_files; i++) {
+        file_name(path, "/create", i);
+        op_begin(&b);
+        ok = fs_create(path);
+        op_end(&b);
+    }
+    return bench_end(&b, ok);
+}
+
+// Workload: build a chain of nested directories, each by its full path
+static bool run_mkdir(void) {
+    struct bench b;
+    char path[FS_MAX_PATH];
+    bool ok = TRUE;
+
+    str_cpy(path, "/deep");
+    bench_begin(&b, "mkdir");
+    for (uint32_t i = 0; ok && i < opt_depth; i++) {
+        if (str_len(path) + 2 >= FS_MAX_PATH) break;
+        if (i > 0) str_cat(path, "/d");
+
+        op_begin(&b);
+        ok = fs_mkdir(path);
+        op_end(&b);
+    }
+    return bench_end(&b, ok);
+}
+
+// Workload: append a large file in CHUNK pieces
+static bool run_write(void) {
+    struct bench b;
+    uint64_t total = (uint64_t)opt_write_mb << 20;
+    bool ok = fs_create("/large");
+    int32_t fd = ok ? fs_fopen("/large") : -1;
+
+    for (uint32_t i = 0; i < CHUNK; i++) chunk_buf[i] = (uint8_t)(i * 31 + 7);
+
+    bench_begin(&b, "write");
+    for (uint64_t done = 0; fd >= 0 && ok && done < total; done += CHUNK) {
+        op_begin(&b);
+        ok = fs_append(fd, chunk_buf, CHUNK) == CHUNK;
+        op_end(&b);
+        b.payload += CHUNK;
+    }
+    if (fd < 0 || !fs_fclose(fd)) ok = FALSE;
+    return bench_end(&b, ok);
+}
+
+// Workload: read the large file back sequentially, cold
+static bool run_read(void) {
+    struct bench b;
+    bool ok = fs_exists("/large") || run_write();
+
+    // Start from an empty cache so every sector comes from the disk
+    ok = ok && fs_sync() && bcache_sync();
+    bcache_init();
+    int32_t fd = ok ? fs_fopen("/large") : -1;
+
+    bench_begin(&b, "read");
+    int32_t n = 1;
+    while (fd >= 0 && ok && n > 0) {
+        op_begin(&b);
+        n = fs_fread(fd, chunk_buf, CHUNK);
+        op_end(&b);
+        ok = n >= 0;
+        if (n > 0) b.payload += n;
+    }
+    if (fd < 0 || !fs_fclose(fd)) ok = FALSE;
+    return bench_end(&b, ok);
+}
+
+// Workload: rounds of creating small files and deleting them again
+static bool run_churn(void) {
+    struct bench b;
+    char path[FS_MAX_PATH];
+    bool ok = fs_mkdir("/churn");
+
+    bench_begin(&b, "churn");
+    for (uint32_t r = 0; ok && r < opt_rounds; r++) {
+        for (uint32_t i = 0; ok && i < opt_round_files; i++) {
+            file_name(path, "/churn", i);
+            op_begin(&b);
+            int32_t fd = fs_create(path) ? fs_fopen(path) : -1;
+            ok = fd >= 0 && fs_append(fd, chunk_buf, CHURN_BYTES) == CHURN_BYTES;
+            if (fd >= 0 && !fs_fclose(fd)) ok = FALSE;
+            op_end(&b);
+            b.payload += CHURN_BYTES;
+        }
+        for (uint32_t i = 0; ok && i < opt_round_files; i++) {
+            file_name(path, "/churn", i);
+            op_begin(&b);
+            ok = fs_delete(path);
+            op_end(&b);
+        }
+    }
+    return bench_end(&b, ok);
+}
+
+struct workload {
+    const char *name;
+    bool (*run)(void);
+};
+
+static const struct workload workloads[] = {
+    {"create", run_create},
+    {"mkdir",  run_mkdir},
+    {"write",  run_write},
+    {"read",   run_read},
+    {"churn",  run_churn},
+};
+
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+static void usage(void) {
+    host_error("Usage: fsbench [-n files] [-d depth] [-s write_mb] [-r rounds] [-k files_per_round]\n");
+    host_error("               [-c cluster_bytes] [-m disk_mb] [-f image] [-z] [workload...]\n");
+    host_error("Workloads: create mkdir write read churn (default: all)\n");
+}
+
+int main(int argc, char **argv) {
+    const struct workload *selected[WORKLOAD_COUNT];
+    uint32_t count = 0;
+    uint32_t cluster_size = 0;
+    uint32_t disk_mb = 256;
+    const char *image = NULL;
+    bool compress = FALSE;
+
+    for (int i = 1; i < argc; i++) {
+        uint32_t *value = NULL;
+        if (str_cmp(argv[i], "-n") == 0) value = &opt_files;
+        else if (str_cmp(argv[i], "-d") == 0) value = &opt_depth;
+        else if (str_cmp(argv[i], "-s") == 0) value = &opt_write_mb;
+        else if (str_cmp(argv[i], "-r") == 0) value = &opt_rounds;
+        else if (str_cmp(argv[i], "-k") == 0) value = &opt_round_files;
+        else if (str_cmp(argv[i], "-c") == 0) value = &cluster_size;
+        else if (str_cmp(argv[i], "-m") == 0) value = &disk_mb;
+
+        if (value != NULL) {
+            if (i + 1 == argc || !str_to_uint(argv[++i], value)) {
+                usage();
+                return 2;
+            }
+            continue;
+        }
+        if (str_cmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            image = argv[++i];
+            continue;
+        }
+        if (str_cmp(argv[i], "-z") == 0) {
+            compress = TRUE;
+            continue;
+        }
+
+        uint32_t w = 0;
+        while (w < WORKLOAD_COUNT && str_cmp(argv[i], workloads[w].name) != 0) w++;
+        if (w == WORKLOAD_COUNT || count == WORKLOAD_COUNT) {
+            usage();
+            return 2;
+        }
+        selected[count++] = &workloads[w];
+    }
+    if (count == 0) {
+        for (uint32_t w = 0; w < WORKLOAD_COUNT; w++) selected[count++] = &workloads[w];
+    }
+
+    if (disk_mb == 0 || !host_image_create(image, (uint64_t)disk_mb << 20)) {
+        host_error("fsbench: cannot create the disk\n");
+        return 1;
+    }
+
+    bcache_init();
+    if (!fs_format(cluster_size, 0) || (compress && !fs_set_compressed("/", TRUE))) {
+        host_error("fsbench: format failed\n");
+        return 1;
+    }
+
+    host_print("disk ");
+    put_dec(disk_mb, 0);
+    host_print(" MB, cluster ");
+    put_dec(cluster_size != 0 ? cluster_size : FS_DEFAULT_CLUSTER_SIZE, 0);
+    host_print(" bytes, ");
+    if (compress) host_print("compressed, ");
+    host_print(image != NULL ? image : "in memory");
+    host_print("\n\n");
+    host_print("workload    ops  total ms   avg us   max us  rd cmds   rd sec  wr cmds   wr sec flush   sec/op    amp     hits  misses\n");
+
+    bool ok = TRUE;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!selected[i]->run()) ok = FALSE;
+    }
+
+    host_image_close();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+#define _FILE_OFFSET_BITS 64
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "host.h"
+
+static int image = -1;
+static unsigned char *image_mem;    // Memory-backed image instead of a file
+static unsigned long long image_sectors;
+
+// Helper: Transfer a whole run, retrying short reads and writes
+static int transfer(unsigned long long lba, unsigned int count, void *buf, int write) {
+    size_t len = (size_t)count * 512;
+    off_t off = (off_t)(lba * 512);
+    char *p = buf;
+
+    if (lba + count > image_sectors) return 0;
+
+    if (image_mem != NULL) {
+        if (write) memcpy(image_mem + off, buf, len);
+        else memcpy(buf, image_mem + off, len);
+        return 1;
+    }
+
+    while (len > 0) {
+        ssize_t n = write ? pwrite(image, p, len, off) : pread(image, p, len, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        off += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+int host_image_open(const char *path) {
+    struct stat st;
+
+    image = open(path, O_RDWR);
+    if (image < 0 || fstat(image, &st) != 0) return 0;
+
+    image_sectors = (unsigned long long)st.st_size / 512;
+    return 1;
+}
+
+int host_image_create(const char *path, unsigned long long bytes) {
+    // Anonymous pages: zero until written, and free of syscall noise
+    if (path == NULL) {
+        void *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mem == MAP_FAILED) return 0;
+
+        image_mem = mem;
+        image_sectors = bytes / 512;
+        return 1;
+    }
+
+    // Sparse: only the sectors the filesystem writes take up space
+    image = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (image < 0 || ftruncate(image, (off_t)bytes) != 0) return 0;
+
+    image_sectors = bytes / 512;
+    return 1;
+}
+
+unsigned long long host_image_sectors(void) {
+    return image_sectors;
+}
+
+int host_image_read(unsigned long long lba, unsigned int count, void *buf) {
+    return transfer(lba, count, buf, 0);
+}
+
+int host_image_write(unsigned long long lba, unsigned int count, const void *buf) {
+    return transfer(lba, count, (void *)buf, 1);
+}
+
+int host_image_sync(void) {
+    return image_mem != NULL || fsync(image) == 0;
+}
+
+void host_image_close(void) {
+    if (image_mem != NULL) munmap(image_mem, image_sectors * 512);
+    if (image >= 0) close(image);
+    image_mem = NULL;
+    image = -1;
+}
+
+void host_print(const char *s) {
+    fputs(s, stdout);
+}
+
+void host_error(const char *s) {
+    fflush(stdout);
+    fputs(s, stderr);
+}
+
+unsigned long long host_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int host_type(const char *path) {
+    struct stat st;
+
+    if (stat(path, &st) != 0) return HOST_NONE;
+    if (S_ISDIR(st.st_mode)) return HOST_DIR;
+    if (S_ISREG(st.st_mode)) return HOST_FILE;
+    return HOST_NONE;   // Devices, sockets and the like are not imported
+}
+
+void *host_dir_open(const char *path) {
+    return opendir(path);
+}
+
+int host_dir_next(void *dir, char *name, unsigned int size) {
+    struct dirent *e;
+
+    while ((e = readdir(dir)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+
+        snprintf(name, size, "%s", e->d_name);
+        return 1;
+    }
+    return 0;
+}
+
+void host_dir_close(void *dir) {
+    closedir(dir);
+}
+
+int host_mkdir(const char *path) {
+    return mkdir(path, 0755) == 0 || (errno == EEXIST && host_type(path) == HOST_DIR);
+}
+
+void *host_file_open(const char *path, int write) {
+    return fopen(path, write ? "wb" : "rb");
+}
+
+int host_file_read(void *file, void *buf, unsigned int len) {
+    size_t n = fread(buf, 1, len, file);
+    return ferror((FILE *)file) ? -1 : (int)n;
+}
+
+int host_file_write(void *file, const void *buf, unsigned int len) {
+    return fwrite(buf, 1, len, file) == len;
+}
+
+int host_file_close(void *file) {
+    return fclose(file) == 0;
+}
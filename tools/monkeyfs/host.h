@@ -0,0 +1,40 @@
+#ifndef HOST_H
+#define HOST_H
+
+// Host services for the monkeyfs and fsbench tools. The filesystem code is
+// built against the kernel headers, which clash with libc's, so everything
+// that needs libc sits behind this interface (plain C types only).
+
+// Disk image backing drive 0
+int  host_image_open(const char *path);                             // Existing image
+int  host_image_create(const char *path, unsigned long long bytes); // Truncates; NULL for memory
+unsigned long long host_image_sectors(void);
+int  host_image_read(unsigned long long lba, unsigned int count, void *buf);
+int  host_image_write(unsigned long long lba, unsigned int count, const void *buf);
+int  host_image_sync(void);
+void host_image_close(void);
+
+// Console
+void host_print(const char *s);
+void host_error(const char *s);     // To stderr
+
+// Monotonic clock
+unsigned long long host_time_ns(void);
+
+// Host files and directories
+#define HOST_NONE   0
+#define HOST_FILE   1
+#define HOST_DIR    2
+
+int   host_type(const char *path);                          // HOST_*
+void *host_dir_open(const char *path);
+int   host_dir_next(void *dir, char *name, unsigned int size);  // Skips "." and ".."
+void  host_dir_close(void *dir);
+int   host_mkdir(const char *path);                         // Succeeds if it exists
+
+void *host_file_open(const char *path, int write);
+int   host_file_read(void *file, void *buf, unsigned int len);  // Bytes, 0 at the end, -1 on error
+int   host_file_write(void *file, const void *buf, unsigned int len);
+int   host_file_close(void *file);
+
+#endif
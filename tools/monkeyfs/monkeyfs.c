@@ -0,0 +1,435 @@
+#include "fs.h"
+#include "bcache.h"
+#include "string.h"
+#include "host.h"
+
+// monkeyfs: create, populate and inspect MonkeyFS disk images on the build
+// host. It runs the kernel's own fs.c and bcache.c over an image file, so
+// images are laid out exactly as the kernel's 'format' would lay them out.
+//
+//   monkeyfs mkfs <image> <size>[K|M|G] [-c cluster_bytes] [-i inodes] [source_dir]
+//   monkeyfs import <image> <source> [image_dir]
+//   monkeyfs export <image> <path> <dest>
+//   monkeyfs ls <image> [path]
+
+#define HOST_PATH_MAX   4096
+#define COPY_CHUNK      65536
+
+// Paths being walked; each level appends a component and strips it again
+static char host_path[HOST_PATH_MAX];
+static char image_path[FS_MAX_PATH];
+
+static uint8_t copy_buf[COPY_CHUNK];
+
+static uint32_t files_done;
+static uint32_t dirs_done;
+static uint64_t bytes_done;
+
+static void print_dec(uint64_t value) {
+    char buf[24];
+    int i = sizeof(buf) - 1;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    host_print(&buf[i]);
+}
+
+static void fail(const char *what, const char *path) {
+    host_error("monkeyfs: ");
+    host_error(what);
+    if (path != NULL) {
+        host_error(": ");
+        host_error(path);
+    }
+    host_error("\n");
+}
+
+static void usage(void) {
+    host_error("Usage: monkeyfs mkfs <image> <size>[K|M|G] [-c cluster_bytes] [-i inodes] [source_dir]\n");
+    host_error("       monkeyfs import <image> <source> [image_dir]\n");
+    host_error("       monkeyfs export <image> <path> <dest>\n");
+    host_error("       monkeyfs ls <image> [path]\n");
+}
+
+// Helper: Parse a byte count with an optional binary K/M/G suffix
+static bool parse_size(const char *s, uint64_t *bytes) {
+    uint64_t value = 0;
+    if (*s == '\0') return FALSE;
+
+    for (; *s >= '0' && *s <= '9'; s++) {
+        value = value * 10 + (*s - '0');
+        if (value > (1ull << 42)) return FALSE;
+    }
+
+    if (*s == 'K' || *s == 'k') { value <<= 10; s++; }
+    else if (*s == 'M' || *s == 'm') { value <<= 20; s++; }
+    else if (*s == 'G' || *s == 'g') { value <<= 30; s++; }
+
+    *bytes = value;
+    return *s == '\0';
+}
+
+// Helper: Append "/name" to a path buffer; returns the old length, -1 if it does not fit
+static int32_t path_push(char *path, uint32_t size, const char *name) {
+    uint32_t len = str_len(path);
+    uint32_t sep = (len > 0 && path[len - 1] != '/') ? 1 : 0;
+
+    if (len + sep + str_len(name) >= size) return -1;
+    if (sep) path[len] = '/';
+    str_cpy(path + len + sep, name);
+    return len;
+}
+
+// Helper: Type of an image path (INODE_TYPE_FREE if it does not exist)
+static uint8_t image_type(const char *path) {
+    uint32_t inode_num;
+    struct inode inode;
+
+    if (!fs_open(path, &inode_num) || !fs_get_inode(inode_num, &inode)) {
+        return INODE_TYPE_FREE;
+    }
+    return inode.type;
+}
+
+// Helper: Copy host_path into the image file at image_path, replacing its contents
+static bool import_file(void) {
+    uint8_t type = image_type(image_path);
+    if (type == INODE_TYPE_DIR || (type == INODE_TYPE_FREE && !fs_create(image_path))) {
+        fail("cannot create", image_path);
+        return FALSE;
+    }
+
+    void *src = host_file_open(host_path, 0);
+    if (src == NULL) {
+        fail("cannot read", host_path);
+        return FALSE;
+    }
+
+    int32_t fd = fs_fopen(image_path);
+    bool ok = fd >= 0 && fs_truncate(fd, 0);
+    int n;
+    while (ok && (n = host_file_read(src, copy_buf, sizeof(copy_buf))) != 0) {
+        ok = n > 0 && fs_append(fd, copy_buf, n) == n;
+        if (ok) bytes_done += n;
+    }
+    if (!ok) fail("write failed (image full or file too large)", image_path);
+
+    if (fd >= 0 && !fs_fclose(fd)) ok = FALSE;
+    host_file_close(src);
+
+    if (ok) files_done++;
+    return ok;
+}
+
+// Helper: Copy the host tree at host_path into the image directory at image_path
+static bool import_tree(void) {
+    void *dir = host_dir_open(host_path);
+    if (dir == NULL) {
+        fail("cannot open directory", host_path);
+        return FALSE;
+    }
+
+    bool ok = TRUE;
+    char name[256];
+    while (ok && host_dir_next(dir, name, sizeof(name))) {
+        int32_t host_len = path_push(host_path, sizeof(host_path), name);
+        if (host_len < 0) {
+            fail("path too long", name);
+            ok = FALSE;
+            break;
+        }
+
+        int type = host_type(host_path);
+        if (type == HOST_NONE) {
+            fail("skipping special file", host_path);
+            host_path[host_len] = '\0';
+            continue;
+        }
+
+        int32_t image_len = -1;
+        if (str_len(name) >= FS_MAX_FILENAME ||
+            (image_len = path_push(image_path, sizeof(image_path), name)) < 0) {
+            fail("name too long for MonkeyFS", host_path);
+            ok = FALSE;
+        } else if (type == HOST_DIR) {
+            uint8_t existing = image_type(image_path);
+            if (existing != INODE_TYPE_DIR && !fs_mkdir(image_path)) {
+                fail("cannot create directory", image_path);
+                ok = FALSE;
+            } else {
+                dirs_done++;
+                ok = import_tree();
+            }
+        } else {
+            ok = import_file();
+        }
+
+        if (image_len >= 0) image_path[image_len] = '\0';
+        host_path[host_len] = '\0';
+    }
+
+    host_dir_close(dir);
+    return ok;
+}
+
+// Helper: Import a host file or tree at 'source' into image directory 'dest'
+static bool import(const char *source, const char *dest) {
+    if (image_type(dest) != INODE_TYPE_DIR) {
+        fail("not a directory in the image", dest);
+        return FALSE;
+    }
+    if (str_len(source) >= sizeof(host_path)) {
+        fail("path too long", source);
+        return FALSE;
+    }
+    str_cpy(host_path, source);
+    str_ncpy(image_path, dest, sizeof(image_path) - 1);
+
+    int type = host_type(source);
+    if (type == HOST_DIR) {
+        if (!import_tree()) return FALSE;
+    } else if (type == HOST_FILE) {
+        const char *name = str_rchr(source, '/');
+        name = name != NULL ? name + 1 : source;
+        if (str_len(name) >= FS_MAX_FILENAME ||
+            path_push(image_path, sizeof(image_path), name) < 0) {
+            fail("name too long for MonkeyFS", source);
+            return FALSE;
+        }
+        if (!import_file()) return FALSE;
+    } else {
+        fail("cannot read", source);
+        return FALSE;
+    }
+
+    print_dec(files_done);
+    host_print(" files, ");
+    print_dec(dirs_done);
+    host_print(" directories, ");
+    print_dec(bytes_done);
+    host_print(" bytes imported\n");
+    return TRUE;
+}
+
+// Helper: Copy the image file at image_path out to host_path
+static bool export_file(void) {
+    void *dst = host_file_open(host_path, 1);
+    if (dst == NULL) {
+        fail("cannot write", host_path);
+        return FALSE;
+    }
+
+    int32_t fd = fs_fopen(image_path);
+    bool ok = fd >= 0;
+    int32_t n;
+    while (ok && (n = fs_fread(fd, copy_buf, sizeof(copy_buf))) != 0) {
+        ok = n > 0 && host_file_write(dst, copy_buf, n);
+        if (ok) bytes_done += n;
+    }
+    if (fd >= 0) fs_fclose(fd);
+    if (!host_file_close(dst)) ok = FALSE;
+
+    if (!ok) fail("read failed", image_path);
+    else files_done++;
+    return ok;
+}
+
+// Helper: Copy the image tree at image_path out to host directory host_path
+static bool export_tree(void) {
+    if (!host_mkdir(host_path)) {
+        fail("cannot create directory", host_path);
+        return FALSE;
+    }
+    dirs_done++;
+
+    uint32_t cursor = 0;
+    struct dir_entry e;
+    bool ok = TRUE;
+    while (ok && fs_read_dir(image_path, &cursor, &e)) {
+        int32_t image_len = path_push(image_path, sizeof(image_path), e.name);
+        int32_t host_len = path_push(host_path, sizeof(host_path), e.name);
+
+        if (image_len < 0 || host_len < 0) {
+            fail("path too long", e.name);
+            ok = FALSE;
+        } else if (e.type == INODE_TYPE_DIR) {
+            ok = export_tree();
+        } else {
+            ok = export_file();
+        }
+
+        if (image_len >= 0) image_path[image_len] = '\0';
+        if (host_len >= 0) host_path[host_len] = '\0';
+    }
+    return ok;
+}
+
+static bool export(const char *path, const char *dest) {
+    if (str_len(path) >= sizeof(image_path) || str_len(dest) >= sizeof(host_path)) {
+        fail("path too long", NULL);
+        return FALSE;
+    }
+    str_cpy(image_path, path);
+    str_cpy(host_path, dest);
+
+    uint8_t type = image_type(path);
+    bool ok;
+    if (type == INODE_TYPE_DIR) {
+        ok = export_tree();
+    } else if (type == INODE_TYPE_FILE) {
+        // Into an existing directory, keep the file's own name
+        if (host_type(dest) == HOST_DIR) {
+            const char *name = str_rchr(path, '/');
+            name = name != NULL ? name + 1 : path;
+            if (path_push(host_path, sizeof(host_path), name) < 0) {
+                fail("path too long", dest);
+                return FALSE;
+            }
+        }
+        ok = export_file();
+    } else {
+        fail("no such file or directory in the image", path);
+        return FALSE;
+    }
+
+    if (ok) {
+        print_dec(files_done);
+        host_print(" files, ");
+        print_dec(bytes_done);
+        host_print(" bytes exported\n");
+    }
+    return ok;
+}
+
+// Helper: Print every entry below image_path, one per line with its size
+static bool list_tree(void) {
+    uint32_t cursor = 0;
+    struct dir_entry e;
+    bool ok = TRUE;
+
+    while (ok && fs_read_dir(image_path, &cursor, &e)) {
+        int32_t len = path_push(image_path, sizeof(image_path), e.name);
+        if (len < 0) {
+            fail("path too long", e.name);
+            return FALSE;
+        }
+
+        struct inode inode;
+        if (!fs_get_inode(e.inode, &inode)) {
+            fail("cannot read inode", image_path);
+            ok = FALSE;
+        } else if (e.type == INODE_TYPE_DIR) {
+            host_print("d            ");
+            host_print(image_path);
+            host_print("/\n");
+            ok = list_tree();
+        } else {
+            char num[24];
+            uint32_t n = uint_to_str(inode.size, num);
+            host_print("f ");
+            while (n++ < 10) host_print(" ");
+            host_print(num);
+            host_print(" ");
+            host_print(image_path);
+            host_print("\n");
+        }
+        image_path[len] = '\0';
+    }
+    return ok;
+}
+
+static bool list(const char *path) {
+    if (str_len(path) >= sizeof(image_path)) {
+        fail("path too long", path);
+        return FALSE;
+    }
+    if (image_type(path) != INODE_TYPE_DIR) {
+        fail("not a directory in the image", path);
+        return FALSE;
+    }
+    str_cpy(image_path, path);
+    return list_tree();
+}
+
+static bool make_fs(int argc, char **argv) {
+    const char *pos[3];
+    int npos = 0;
+    uint32_t cluster_size = 0;
+    uint32_t inode_count = 0;
+    uint64_t bytes;
+
+    bool ok = TRUE;
+    for (int i = 0; ok && i < argc; i++) {
+        if (str_cmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            ok = str_to_uint(argv[++i], &cluster_size);
+        } else if (str_cmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            ok = str_to_uint(argv[++i], &inode_count);
+        } else if (npos < 3) {
+            pos[npos++] = argv[i];
+        } else {
+            ok = FALSE;
+        }
+    }
+    if (!ok || npos < 2 || !parse_size(pos[1], &bytes)) {
+        usage();
+        return FALSE;
+    }
+
+    if (!host_image_create(pos[0], bytes)) {
+        fail("cannot create image", pos[0]);
+        return FALSE;
+    }
+
+    bcache_init();
+    if (!fs_format(cluster_size, inode_count)) {
+        fail("format failed (bad cluster size or inode count, or image too small)", NULL);
+        return FALSE;
+    }
+
+    return npos < 3 || import(pos[2], "/");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        usage();
+        return 2;
+    }
+
+    const char *cmd = argv[1];
+    bool ok;
+
+    if (str_cmp(cmd, "mkfs") == 0) {
+        ok = make_fs(argc - 2, argv + 2);
+    } else {
+        if (!host_image_open(argv[2])) {
+            fail("cannot open image", argv[2]);
+            return 1;
+        }
+        bcache_init();
+        if (!fs_mount()) {
+            fail("not a MonkeyFS image", argv[2]);
+            return 1;
+        }
+
+        if (str_cmp(cmd, "import") == 0 && (argc == 4 || argc == 5)) {
+            ok = import(argv[3], argc == 5 ? argv[4] : "/");
+        } else if (str_cmp(cmd, "export") == 0 && argc == 5) {
+            ok = export(argv[3], argv[4]);
+        } else if (str_cmp(cmd, "ls") == 0 && argc <= 4) {
+            ok = list(argc == 4 ? argv[3] : "/");
+        } else {
+            usage();
+            ok = FALSE;
+        }
+    }
+
+    if (fs_is_mounted() && !fs_sync()) {
+        fail("sync failed", NULL);
+        ok = FALSE;
+    }
+    host_image_close();
+    return ok ? 0 : 1;
+}